@@ -0,0 +1,181 @@
+/*
+ * arena.c - per-crash memory arena for the crash handler
+ *
+ * Copyright 2011,2012 Sony Network Entertainment
+ *
+ * Each block is preceded by a small header holding its size, so that
+ * arena_realloc() knows how much to copy and arena_free() can tell
+ * whether the block is the last one handed out.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+#include "crash_handler.h"
+
+/* alignment of every block, which is also the size of its header */
+#define ARENA_ALIGN	8
+
+static unsigned char *arena_base;
+static size_t arena_cap;
+static size_t arena_used;
+static size_t arena_peak;
+
+#define ARENA_ROUND(n)	(((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define BLOCK_SIZE(p)	(*(size_t *)((unsigned char *)(p) - ARENA_ALIGN))
+
+static int in_arena(void *ptr)
+{
+    return arena_base && (unsigned char *)ptr >= arena_base &&
+           (unsigned char *)ptr < arena_base + arena_cap;
+}
+
+/* is ptr the block at the top of the arena? */
+static int is_last_block(void *ptr)
+{
+    return (unsigned char *)ptr + ARENA_ROUND(BLOCK_SIZE(ptr)) ==
+           arena_base + arena_used;
+}
+
+int arena_init(size_t size, int lock)
+{
+    void *base;
+
+    if (arena_base) {
+        arena_release();
+    }
+    size = ARENA_ROUND(size);
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (base == MAP_FAILED) {
+        DLOG("arena: could not map %u bytes\n", (unsigned)size);
+        return -1;
+    }
+    /* not being able to lock it is no reason to give up */
+    if (lock && mlock(base, size)) {
+        DLOG("arena: could not lock %u bytes\n", (unsigned)size);
+    }
+    arena_base = base;
+    arena_cap = size;
+    arena_used = arena_peak = 0;
+    return 0;
+}
+
+void *arena_alloc(size_t size)
+{
+    unsigned char *p;
+    size_t need;
+
+    if (!arena_base) {
+        return malloc(size);
+    }
+    need = ARENA_ALIGN + ARENA_ROUND(size);
+    if (size > arena_cap || need > arena_cap - arena_used) {
+        return NULL;
+    }
+    p = arena_base + arena_used + ARENA_ALIGN;
+    BLOCK_SIZE(p) = size;
+    arena_used += need;
+    if (arena_used > arena_peak) {
+        arena_peak = arena_used;
+    }
+    return p;
+}
+
+void *arena_calloc(size_t count, size_t size)
+{
+    void *p;
+
+    if (size && count > (size_t)-1 / size) {
+        return NULL;
+    }
+    p = arena_alloc(count * size);
+    if (p) {
+        memset(p, 0, count * size);
+    }
+    return p;
+}
+
+void *arena_realloc(void *ptr, size_t size)
+{
+    void *p;
+    size_t old;
+
+    if (!ptr) {
+        return arena_alloc(size);
+    }
+    if (!in_arena(ptr)) {
+        return realloc(ptr, size);
+    }
+
+    old = BLOCK_SIZE(ptr);
+    if (is_last_block(ptr)) {
+        size_t start = (unsigned char *)ptr - arena_base;
+
+        if (size > arena_cap || ARENA_ROUND(size) > arena_cap - start) {
+            return NULL;
+        }
+        arena_used = start + ARENA_ROUND(size);
+        if (arena_used > arena_peak) {
+            arena_peak = arena_used;
+        }
+        BLOCK_SIZE(ptr) = size;
+        return ptr;
+    }
+    if (size <= old) {
+        return ptr;
+    }
+
+    p = arena_alloc(size);
+    if (p) {
+        memcpy(p, ptr, old);
+    }
+    return p;
+}
+
+void arena_free(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    if (!in_arena(ptr)) {
+        free(ptr);
+        return;
+    }
+    if (is_last_block(ptr)) {
+        arena_used = (unsigned char *)ptr - ARENA_ALIGN - arena_base;
+    }
+}
+
+size_t arena_high_water(void)
+{
+    return arena_peak;
+}
+
+size_t arena_size(void)
+{
+    return arena_cap;
+}
+
+void arena_release(void)
+{
+    if (arena_base) {
+        munmap(arena_base, arena_cap);
+    }
+    arena_base = NULL;
+    arena_cap = arena_used = arena_peak = 0;
+}
@@ -0,0 +1,60 @@
+/* arena.h - per-crash memory arena
+**
+** Copyright 2011,2012 Sony Network Entertainment
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef __arena_h
+#define __arena_h
+
+#include <stddef.h>
+
+/*
+ * Crashes often happen when the system is short of memory, so everything
+ * the handler needs while writing a report comes out of one block that is
+ * set up (and optionally locked) before any work is done.  Allocation is a
+ * simple bump of a pointer, and the whole arena is released at once at the
+ * end of the report.
+ *
+ * When no arena has been set up (for example when reading a core file
+ * from the command line), these fall back to malloc() and friends.
+ */
+
+/* Reserve an arena of size bytes, and mlock it if lock is set.
+ * Returns 0 on success.
+ */
+extern int arena_init(size_t size, int lock);
+
+/* Allocate size bytes.  Returns NULL once the arena is full. */
+extern void *arena_alloc(size_t size);
+
+/* Allocate zeroed memory for count objects of size bytes */
+extern void *arena_calloc(size_t count, size_t size);
+
+/* Resize a block.  The most recent allocation grows in place. */
+extern void *arena_realloc(void *ptr, size_t size);
+
+/* Give back a block.  Only the most recent allocation is actually
+ * reclaimed; everything else waits for arena_release().
+ */
+extern void arena_free(void *ptr);
+
+/* Most bytes ever in use at once, and the size of the arena */
+extern size_t arena_high_water(void);
+extern size_t arena_size(void);
+
+/* Unmap the arena and everything allocated from it */
+extern void arena_release(void);
+
+#endif
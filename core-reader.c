@@ -0,0 +1,278 @@
+/*
+ * core-reader.c - memory reader over an ELF core file
+ *
+ * Copyright 2011,2012 Sony Network Entertainment
+ *
+ * This lets the unwinders run offline, against a core file saved with
+ * DO_CORE_FILE (or by any other means), instead of a live process.
+ * The file is mapped read-only, and memory reads are served straight
+ * out of its PT_LOAD segments.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/procfs.h>
+
+#include "memreader.h"
+#include "arena.h"
+#include "crash_handler.h"
+
+#ifndef NT_FILE
+#define NT_FILE		0x46494c45	/* mapped files, kernel 3.7 and up */
+#endif
+
+typedef struct core_reader {
+    memreader mr;
+    unsigned char *image;
+    size_t size;
+    Elf32_Phdr *phdr;
+    int phnum;
+    int have_regs;
+    struct pt_regs regs;
+    unsigned char *file_note;
+    size_t file_note_size;
+} core_reader;
+
+/* Find the PT_LOAD segment that holds addr, or NULL */
+static Elf32_Phdr *core_find_load(core_reader *cr, unsigned addr)
+{
+    Elf32_Phdr *ph;
+    int i;
+
+    for (i = 0; i < cr->phnum; i++) {
+        ph = &cr->phdr[i];
+        if (ph->p_type == PT_LOAD && addr >= ph->p_vaddr &&
+            addr - ph->p_vaddr < ph->p_memsz) {
+            return ph;
+        }
+    }
+    return NULL;
+}
+
+static size_t core_read(memreader *mr, unsigned addr, void *dst, size_t size)
+{
+    core_reader *cr = (core_reader *)mr;
+    Elf32_Phdr *ph;
+    size_t done = 0;
+    size_t chunk;
+    unsigned offset;
+
+    while (done < size) {
+        ph = core_find_load(cr, addr+done);
+        if (!ph) {
+            break;
+        }
+        offset = addr + done - ph->p_vaddr;
+        /* pages the kernel left out of the dump are not in the file */
+        if (offset >= ph->p_filesz ||
+            ph->p_offset + ph->p_filesz > cr->size) {
+            break;
+        }
+        chunk = ph->p_filesz - offset;
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+        memcpy(dst+done, cr->image + ph->p_offset + offset, chunk);
+        done += chunk;
+    }
+    return done;
+}
+
+static int core_get_regs(memreader *mr, struct pt_regs *regs)
+{
+    core_reader *cr = (core_reader *)mr;
+
+    if (!cr->have_regs) {
+        return -1;
+    }
+    memcpy(regs, &cr->regs, sizeof(*regs));
+    return 0;
+}
+
+static int core_get_region(memreader *mr, unsigned addr, unsigned *start,
+                           unsigned *end)
+{
+    core_reader *cr = (core_reader *)mr;
+    Elf32_Phdr *ph;
+
+    ph = core_find_load(cr, addr);
+    if (!ph) {
+        return 0;
+    }
+    *start = ph->p_vaddr;
+    *end = ph->p_vaddr + ph->p_memsz;
+    return 1;
+}
+
+static void core_close(memreader *mr)
+{
+    core_reader *cr = (core_reader *)mr;
+
+    munmap(cr->image, cr->size);
+    arena_free(cr);
+}
+
+/* Walk the notes in one PT_NOTE segment, picking up the registers of the
+ * first thread (the one that crashed) and the mapped file list.
+ */
+static void core_parse_notes(core_reader *cr, Elf32_Phdr *ph)
+{
+    unsigned char *p, *end, *desc;
+    Elf32_Nhdr *nh;
+
+    if (ph->p_offset + ph->p_filesz > cr->size) {
+        return;
+    }
+    p = cr->image + ph->p_offset;
+    end = p + ph->p_filesz;
+
+    while (p + sizeof(Elf32_Nhdr) <= end) {
+        nh = (Elf32_Nhdr *)p;
+        desc = p + sizeof(Elf32_Nhdr) + ((nh->n_namesz + 3) & ~3);
+        if (desc + nh->n_descsz > end) {
+            break;
+        }
+
+        if (nh->n_type == NT_PRSTATUS && !cr->have_regs &&
+            nh->n_descsz >= sizeof(struct elf_prstatus)) {
+            struct elf_prstatus *prs = (struct elf_prstatus *)desc;
+
+            memcpy(&cr->regs, &prs->pr_reg, sizeof(cr->regs));
+            cr->have_regs = 1;
+        } else if (nh->n_type == NT_FILE) {
+            cr->file_note = desc;
+            cr->file_note_size = nh->n_descsz;
+        }
+
+        p = desc + ((nh->n_descsz + 3) & ~3);
+    }
+}
+
+memreader *open_core_reader(const char *path)
+{
+    core_reader *cr;
+    Elf32_Ehdr *ehdr;
+    struct stat sb;
+    int fd;
+    int i;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    cr = arena_calloc(1, sizeof(core_reader));
+    if (!cr || fstat(fd, &sb) || sb.st_size < sizeof(Elf32_Ehdr)) {
+        close(fd);
+        arena_free(cr);
+        return NULL;
+    }
+    cr->size = sb.st_size;
+    cr->image = mmap(NULL, cr->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (cr->image == MAP_FAILED) {
+        arena_free(cr);
+        return NULL;
+    }
+
+    ehdr = (Elf32_Ehdr *)cr->image;
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != ELFCLASS32 ||
+        ehdr->e_type != ET_CORE ||
+        ehdr->e_phoff + ehdr->e_phnum * sizeof(Elf32_Phdr) > cr->size) {
+        munmap(cr->image, cr->size);
+        arena_free(cr);
+        return NULL;
+    }
+    cr->phdr = (Elf32_Phdr *)(cr->image + ehdr->e_phoff);
+    cr->phnum = ehdr->e_phnum;
+
+    for (i = 0; i < cr->phnum; i++) {
+        if (cr->phdr[i].p_type == PT_NOTE) {
+            core_parse_notes(cr, &cr->phdr[i]);
+        }
+    }
+
+    cr->mr.read = core_read;
+    cr->mr.get_regs = core_get_regs;
+    cr->mr.get_region = core_get_region;
+    cr->mr.close = core_close;
+
+    return &cr->mr;
+}
+
+/*
+ * The NT_FILE note is laid out as:
+ *   count, page_size, then count * { start, end, file_ofs }, then
+ *   count NUL-terminated file names.
+ * Only mappings whose PT_LOAD segment is executable are returned,
+ * just like get_mapinfo_list() does for a live process.
+ */
+maptable *get_core_mapinfo_list(memreader *mr)
+{
+    core_reader *cr = (core_reader *)mr;
+    maptable *milist;
+    mapinfo mi;
+    unsigned *entry;
+    unsigned count, i;
+    char *name, *end;
+    Elf32_Phdr *ph;
+
+    if (!cr->file_note || cr->file_note_size < 8) {
+        return NULL;
+    }
+    entry = (unsigned *)cr->file_note;
+    count = entry[0];
+    if (count > (cr->file_note_size - 8) / 12) {
+        return NULL;
+    }
+    name = (char *)(entry + 2 + count * 3);
+    end = (char *)cr->file_note + cr->file_note_size;
+
+    milist = arena_calloc(1, sizeof(maptable));
+    if (!milist) {
+        return NULL;
+    }
+
+    /* the names point straight into the note, which stays mapped until
+     * the reader is closed
+     */
+    for (i = 0; i < count && name < end; i++) {
+        size_t len = strnlen(name, end - name);
+
+        if (name + len == end) {
+            break;
+        }
+        mi.start = entry[2 + i*3];
+        mi.end = entry[2 + i*3 + 1];
+        mi.offset = entry[2 + i*3 + 2] * entry[1];
+        mi.obj = NULL;
+        mi.name = name;
+
+        ph = core_find_load(cr, mi.start);
+        if (ph && (ph->p_flags & PF_X)) {
+            maptable_add(milist, &mi);
+        }
+        name += len + 1;
+    }
+    maptable_sort(milist);
+    maptable_link_objects(milist);
+    maptable_index_pages(milist);
+    return milist;
+}
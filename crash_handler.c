@@ -52,6 +52,10 @@
 #include <sys/wait.h>
 
 #include "utility.h"
+#include "memreader.h"
+#include "arena.h"
+#include "unwind-cache.h"
+#include "report-render.h"
 #include "crash_handler.h"
 
 #define VERSION	0
@@ -70,10 +74,45 @@
 /* set to 1 to save a full core file for each crash report */
 #define DO_CORE_FILE 	0
 
+/* memory set aside (and locked, if ARENA_MLOCK) for each crash report */
+#define ARENA_SIZE		(4*1024*1024)
+#define ARENA_MLOCK		1
+
+/* report output collected before it is written out */
+#define REPORT_BUFFER_SIZE	(64*1024)
+
+/* write reports as binary records (1), to be turned into text later with
+ * crash_handler --render, or as text (0) */
+#define REPORT_BINARY		0
+
+/* write reports as newline-delimited JSON (1), one object per line, for
+ * machine ingestion; REPORT_BINARY takes precedence */
+#define REPORT_JSON		0
+
+/* largest amount of stack copied out of the crashing process; it comes
+ * out of the arena, so only a part of that, leaving the rest for the
+ * maps, unwind tables and report buffers */
+#define MAX_STACK_SNAPSHOT	(ARENA_SIZE / 4)
+
+/* keep the unwind tables of libraries seen in earlier crashes on disk */
+#define DO_UNWIND_CACHE		1
+#define UNWIND_CACHE_DIR	"/var/cache/crash_handler"
+#define UNWIND_CACHE_SIZE	(2*1024*1024)
+
+/* most frames an unwinder may walk, so that runaway recursion doesn't
+ * make for a huge report */
+#define MAX_BACKTRACE_FRAMES	4096
+
 /* select which unwinder(s) to use for backtrace */
+#define USE_HYBRID_UNWINDER	1	/* replaces the table and guess ones */
+#define USE_FP_UNWINDER		1	/* first, in the hybrid one */
 #define USE_TABLE_UNWINDER	1
 #define USE_GUESS_UNWINDER	1
-#define USE_MCTERNAN_UNWINDER	0	/* not integrated yet */
+#define USE_MCTERNAN_UNWINDER	1
+
+/* frame records are laid out as with gcc -mapcs-frame (1), or as an
+ * {fp, lr} pair (0) */
+#define FP_FRAME_LAYOUT_APCS	0
 
 /****************************************/
 
@@ -90,12 +129,27 @@ extern void record_crash_to_journal(char *filename, int pid, char *name);
 		     (ehdr).e_ident[EI_MAG3] == ELFMAG3)
 
 #define BUF_SIZE 512
+
+/* initial buffer size for reading /proc/<pid>/maps */
+#define MAPS_READ_SIZE (64*1024)
+
+/* program headers fetched per bulk read in parse_elf_object */
+#define MAX_PHDRS_PER_READ 16
+
+/* PT_NOTE segments searched for a build-id, and how much of each is read */
+#define MAX_NOTE_SEGMENTS 4
+#define NOTE_READ_SIZE 256
+
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID 3
+#endif
 #define ROOT_UID 0
 #define ROOT_GID 0
 
-int report_fd = -1;
 int ts_num = -1;
 mapinfo stack_map;
+stack_snapshot crash_stack;
+static char report_buffer[REPORT_BUFFER_SIZE];
 
 void klog_fmt(const char *fmt, ...)
 {
@@ -127,22 +181,6 @@ void klog_fmt(const char *fmt, ...)
 }
 
 
-/* Log information into the crash_report */
-void report_out(int rfd, const char *fmt, ...)
-{
-    char buf[BUF_SIZE];
-    
-    va_list ap;
-    va_start(ap, fmt);
-
-    if( rfd >= 0 ) {
-	    int len;
-	    vsnprintf(buf, sizeof(buf), fmt, ap);
-	    len = strlen(buf);
-	    write(rfd, buf, len);
-    } 
-}
-
 #define typecheck(x,y) {    \
     typeof(x) __dummy1;     \
     typeof(y) __dummy2;     \
@@ -210,14 +248,28 @@ static int find_and_open_crash_report(void)
 
 
 /* Main entry point to get the backtrace from the crashing process */
-extern int table_unwind_backtrace_with_ptrace(pid_t pid, mapinfo *map,
-                                        unsigned int sp_list[],
+extern int table_unwind_backtrace_with_ptrace(memreader *mr, maptable *map,
+                                        frametable *frames,
                                         int *frame0_pc_sane);
 
-extern int guess_unwind_backtrace_with_ptrace(pid_t pid, mapinfo *map,
-					unsigned int sp_list[],
+extern int guess_unwind_backtrace_with_ptrace(memreader *mr, maptable *map,
+					frametable *frames,
                                         int *frame0_pc_sane);
 
+extern int guess_unwind_continue(memreader *mr, maptable *map,
+                                 frametable *frames, unsigned int sp);
+
+extern int fp_unwind_backtrace(memreader *mr, maptable *map,
+                               frametable *frames, int apcs,
+                               struct pt_regs *regs, int *frame0_pc_sane);
+
+extern int table_unwind_continue(memreader *mr, maptable *map,
+                                 frametable *frames,
+                                 const struct pt_regs *regs);
+
+extern int mcternan_unwind_backtrace(memreader *mr, maptable *map,
+                                     int limit);
+
 void dump_task_info(pid_t pid, unsigned sig, unsigned uid, unsigned gid)
 {
     char path[256];
@@ -256,11 +308,28 @@ void dump_task_info(pid_t pid, unsigned sig, unsigned uid, unsigned gid)
         DLOG("problem opening %s\n", path);
     }
     
-    LOG("[task info]\n");
-    LOG("pid: %u, uid: %u, gid: %u \n", pid, uid, gid);
-    LOG("cmdline: %s\n", cmdline);
-    LOG("name: %s\n", name);
-    LOG("signal: %u\n\n", sig);
+    report_section(report_fd, "task info");
+    if (report_json && report_fd >= 0) {
+        json_begin(report_fd);
+        json_key("pid");
+        json_uint(pid);
+        json_key("uid");
+        json_uint(uid);
+        json_key("gid");
+        json_uint(gid);
+        json_key("cmdline");
+        json_string(cmdline, strlen(cmdline));
+        json_key("name");
+        json_string(name, strlen(name));
+        json_key("signal");
+        json_uint(sig);
+        json_end();
+    } else {
+        LOG("pid: %u, uid: %u, gid: %u \n", pid, uid, gid);
+        LOG("cmdline: %s\n", cmdline);
+        LOG("name: %s\n", name);
+        LOG("signal: %u\n\n", sig);
+    }
 
     record_crash_to_journal(CRASH_JOURNAL_FILENAME, pid, cmdline);
     
@@ -277,104 +346,137 @@ void dump_word(int pid)
     LOG("word at 0 is: %ul\n", data);
 }
 
-// 6f000000-6f01e000 rwxp 00000000 00:0c 16389419   /system/lib/libcomposer.so
-// 012345678901234567890123456789012345678901234567890123456789
-// 0         1         2         3         4         5
-
 /*
- * parse a memory map line
- * Note: only executable maps are returned.  Other maps (data, stack, etc.)
- * are ignored
- */ 
-mapinfo *parse_maps_line(char *line)
+ * Read all of a /proc file into one arena buffer, with a few large
+ * reads.  Returns the length, or -1 if it is empty or can't be read.
+ */
+static int read_proc_file(const char *path, char **bufp)
 {
-    mapinfo *mi;
-    int len = strlen(line);
+    char *buf, *nbuf;
+    int fd, size = 0, cap = MAPS_READ_SIZE;
+    ssize_t n;
 
-    if(len < 1) return 0;
-    /* cut trailing \n */
-    line[--len] = 0;
-    
-    if(len < 50) return 0;
-
-    /* capture size of stack */
-    if (strcmp(line + 49, "[stack]")==0) {
-	stack_map.start = strtoul(line, 0, 16);
-	stack_map.end = strtoul(line+9, 0, 16);
-        strcpy(stack_map.name, line + 49);
-	return 0;
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    buf = arena_alloc(cap);
+    while (buf) {
+        n = read(fd, buf + size, cap - size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        size += n;
+        if (cap - size < 4096) {
+            nbuf = arena_realloc(buf, cap * 2);
+            if (!nbuf) {
+                break;
+            }
+            buf = nbuf;
+            cap *= 2;
+        }
+    }
+    close(fd);
+    if (!buf || size == 0) {
+        arena_free(buf);
+        return -1;
     }
+    *bufp = buf;
+    return size;
+}
 
-    /* ignore non-executable segments */
-    if(line[20] != 'x') return 0;
+/*
+ * get_mapinfo_list - read /proc/<pid>/maps in one go and return a table
+ * of the executable maps
+ */
+maptable *get_mapinfo_list(pid_t pid)
+{
+    char path[64];
+    char *text, *line;
+    int size;
+    maptable *milist;
+
+    milist = arena_calloc(1, sizeof(maptable));
+    if (!milist) {
+        return NULL;
+    }
+    milist->pid = pid;
 
-    mi = malloc(sizeof(mapinfo) + (len - 47));
-    if(mi == 0) return 0;
-    
-    mi->start = strtoul(line, 0, 16);
-    mi->end = strtoul(line + 9, 0, 16);
-    /* To be filled in by parse_exidx_info if the mapped section starts with 
-     * elf_header
-     */
-    mi->exidx_start = mi->exidx_end = 0;
-    mi->next = 0;
-    strcpy(mi->name, line + 49);
+    sprintf(path, "/proc/%d/maps", pid);
+    size = read_proc_file(path, &text);
+    if (size <= 0) {
+        return milist;
+    }
+    /* room for a terminator */
+    line = arena_realloc(text, size + 1);
+    if (!line) {
+        arena_free(text);
+        return milist;
+    }
+    parse_maps_text(milist, line, size, &stack_map);
 
-    return mi;
+    return milist;
 }
 
-void free_mapinfo_list(mapinfo *milist)
+/*
+ * copy the live part of the crashing thread's stack (from just below sp
+ * to the end of its mapping) into the snapshot reader, in a single read.
+ * Everything that walks the stack afterwards reads from this copy.
+ */
+void snapshot_stack(memreader *snap)
 {
-    while(milist) {
-        mapinfo *next = milist->next;
-        free(milist);
-        milist = next;
+    struct pt_regs r;
+    unsigned start, end, map_start, map_end;
+
+    if (!is_snapshot_reader(snap)) return;
+    if(mr_get_regs(snap, &r)) return;
+
+    if (!mr_get_region(snap, r.ARM_sp, &map_start, &map_end)) {
+        DLOG("no mapping contains sp %08lx\n", r.ARM_sp);
+        return;
+    }
+
+    /* include the 64 bytes below sp that dump_stack_and_code shows */
+    start = (r.ARM_sp - 64) & ~3;
+    if (start < map_start) {
+        start = map_start;
+    }
+    end = map_end;
+    if (end - start > MAX_STACK_SNAPSHOT) {
+        end = start + MAX_STACK_SNAPSHOT;
     }
+
+    crash_stack.start = start;
+    crash_stack.end = start + snapshot_capture(snap, start, end);
+    DLOG("stack snapshot %08x-%08x\n", crash_stack.start, crash_stack.end);
 }
 
-mapinfo *get_mapinfo_list(pid_t pid)
+unsigned stack_top(unsigned sp)
 {
-    char data[1024];
-    FILE *fp;
-    mapinfo *milist = 0;
-
-    sprintf(data, "/proc/%d/maps", pid);
-    fp = fopen(data, "r");
-    if(fp) {
-        while(fgets(data, 1024, fp)) {
-	    LOG(" %s", data);
-            mapinfo *mi = parse_maps_line(data);
-            if(mi) {
-                mi->next = milist;
-                milist = mi;
-            }
-        }
-        fclose(fp);
+    if (sp >= crash_stack.start && sp < crash_stack.end) {
+        return crash_stack.end;
     }
-
-    return milist;
+    return stack_map.end;
 }
 
-void dump_registers(int pid) 
+void dump_registers(memreader *mr, maptable *map) 
 {
     struct pt_regs r;
-    //pt_regs r;
+    unsigned regs[NUM_REPORT_REGS];
+    int i;
 
-    LOG("[registers]\n");
-    if(ptrace(PTRACE_GETREGS, pid, 0, &r)) {
+    if(mr_get_regs(mr, &r)) {
+        report_section(report_fd, "registers");
         LOG("cannot get registers: %d (%s)\n", errno, strerror(errno));
         return;
     }
-    
-    LOG(" r0 %08x  r1 %08x  r2 %08x  r3 %08x\n",
-         r.ARM_r0, r.ARM_r1, r.ARM_r2, r.ARM_r3);
-    LOG(" r4 %08x  r5 %08x  r6 %08x  r7 %08x\n",
-         r.ARM_r4, r.ARM_r5, r.ARM_r6, r.ARM_r7);
-    LOG(" r8 %08x  r9 %08x  10 %08x  fp %08x\n",
-         r.ARM_r8, r.ARM_r9, r.ARM_r10, r.ARM_fp);
-    LOG(" ip %08x  sp %08x  lr %08x  pc %08x  cpsr %08x\n",
-         r.ARM_ip, r.ARM_sp, r.ARM_lr, r.ARM_pc, r.ARM_cpsr);  
-    LOG("\n");
+    for (i = 0; i < NUM_REPORT_REGS; i++) {
+        regs[i] = r.uregs[i];
+    }
+    write_registers(regs, map);
 }
 
 const char *get_signame(int sig)
@@ -394,10 +496,19 @@ void dump_fault_addr(int pid, int sig)
 {
     siginfo_t si;
     
-    LOG("[exception info]\n");
+    report_section(report_fd, "exception info");
     memset(&si, 0, sizeof(si));
     if(ptrace(PTRACE_GETSIGINFO, pid, 0, &si)){
         LOG("cannot get siginfo: %d (%s) \n", errno, strerror(errno));
+    } else if (report_json && report_fd >= 0) {
+        json_begin(report_fd);
+        json_key("signal");
+        json_uint(sig);
+        json_key("signame");
+        json_string(get_signame(sig), strlen(get_signame(sig)));
+        json_key("fault_addr");
+        json_uint((unsigned)si.si_addr);
+        json_end();
     } else {
         LOG("signal %d (%s), fault addr %08x\n",
             sig, get_signame(sig), si.si_addr);
@@ -405,92 +516,232 @@ void dump_fault_addr(int pid, int sig)
     LOG("\n");
 }
 
-int dump_pc_code(int pid)
+int dump_pc_code(memreader *mr)
 {
     struct pt_regs r;
-    //pt_regs r;
-    int *start, *end;
-    int val;
-    int *i;
+    unsigned code[PC_CODE_WORDS];
 
-    LOG("[code around PC]\n");
-    if(ptrace(PTRACE_GETREGS, pid, 0, &r)) {
+    if(mr_get_regs(mr, &r)) {
+        report_section(report_fd, "code around PC");
         LOG("cannot get registers: %d (%s)\n", errno, strerror(errno));
+        return -1;
+    }
+
+    memset(code, 0, sizeof(code));
+    mr_read_struct(mr, r.ARM_pc - PC_CODE_WORDS*2, code, sizeof(code));
+    write_pc_code(r.ARM_pc, code);
+    return 0;
+}
+
+/*
+ * look for an NT_GNU_BUILD_ID note in one PT_NOTE segment, with a single
+ * read of (the start of) the segment
+ */
+static int read_build_id(memreader *mr, elfobj *obj, unsigned addr,
+                         unsigned size)
+{
+    unsigned char notes[NOTE_READ_SIZE];
+    unsigned char *p, *end, *desc;
+    Elf32_Nhdr *nh;
+
+    if (size > sizeof(notes)) {
+        size = sizeof(notes);
+    }
+    size = mr_read(mr, addr, notes, size);
+    p = notes;
+    end = notes + size;
+
+    while (p + sizeof(Elf32_Nhdr) <= end) {
+        nh = (Elf32_Nhdr *)p;
+        desc = p + sizeof(Elf32_Nhdr) + ((nh->n_namesz + 3) & ~3);
+        if (desc + nh->n_descsz > end || desc < p) {
+            break;
+        }
+        if (nh->n_type == NT_GNU_BUILD_ID && nh->n_namesz == 4 &&
+            memcmp(p + sizeof(Elf32_Nhdr), "GNU", 4) == 0 &&
+            nh->n_descsz > 0) {
+            obj->build_id_len = nh->n_descsz < MAX_BUILD_ID ?
+                                nh->n_descsz : MAX_BUILD_ID;
+            memcpy(obj->build_id, desc, obj->build_id_len);
+            return 1;
+        }
+        p = desc + ((nh->n_descsz + 3) & ~3);
+    }
+    return 0;
+}
+
+/*
+ * read the ELF and program headers of one object, from the start of the
+ * file as mapped, and work out its load bias, EXIDX range and build-id
+ */
+static void parse_elf_object(memreader *mr, elfobj *obj)
+{
+    Elf32_Ehdr ehdr;
+    Elf32_Phdr phdr[MAX_PHDRS_PER_READ];
+    Elf32_Phdr *ptr;
+    int i, n, count, have_bias = 0, notes = 0;
+    unsigned exidx_vaddr = 0, exidx_size = 0, exidx_offset = 0;
+    unsigned note_vaddr[MAX_NOTE_SEGMENTS], note_size[MAX_NOTE_SEGMENTS];
+
+    /* Read in sizeof(Elf32_Ehdr) worth of data from the beginning of 
+     * the file.
+     */
+    if (mr_read(mr, obj->base, &ehdr, sizeof(ehdr)) != sizeof(ehdr)) {
         return;
     }
-    
-    start = (int *)r.ARM_pc-0x10;
-    end = (int *)r.ARM_pc+0x10;
-    for(i = start; i<end; i++) {
-	val = get_remote_word(pid, i);
-	LOG("0x%08lx: %08lx", (unsigned long)i, val);
-	LOG((unsigned long)i==r.ARM_pc ? " <-- PC\n" : "\n");
+
+    /* Check if it has the matching magic words */
+    if (!IS_ELF(ehdr)) {
+        return;
+    }
+
+    /* Pull the program headers over in bulk, rather than one
+     * header (and one syscall per word) at a time
+     */
+    ptr = (Elf32_Phdr *) (obj->base + ehdr.e_phoff);
+    for (i = 0; i < ehdr.e_phnum; i += count) {
+        count = ehdr.e_phnum - i;
+        if (count > MAX_PHDRS_PER_READ) {
+            count = MAX_PHDRS_PER_READ;
+        }
+        count = mr_read(mr, (unsigned) (ptr+i), phdr,
+                        count * sizeof(Elf32_Phdr))
+                / sizeof(Elf32_Phdr);
+        if (count == 0) {
+            break;
+        }
+        for (n = 0; n < count; n++) {
+            /* the segment holding file offset 0 gives the load bias */
+            if (phdr[n].p_type == PT_LOAD && phdr[n].p_offset == 0 &&
+                !have_bias) {
+                obj->bias = obj->base - phdr[n].p_vaddr;
+                have_bias = 1;
+            }
+            /* Found a EXIDX segment? */
+            if (phdr[n].p_type == PT_ARM_EXIDX) {
+                exidx_vaddr = phdr[n].p_vaddr;
+                exidx_size = phdr[n].p_filesz;
+                exidx_offset = phdr[n].p_offset;
+            }
+            /* notes are read once the bias is known */
+            if (phdr[n].p_type == PT_NOTE && notes < MAX_NOTE_SEGMENTS) {
+                note_vaddr[notes] = phdr[n].p_vaddr;
+                note_size[notes++] = phdr[n].p_filesz;
+            }
+        }
+    }
+
+    for (i = 0; i < notes; i++) {
+        if (read_build_id(mr, obj, note_vaddr[i] + obj->bias, note_size[i])) {
+            break;
+        }
+    }
+
+    if (exidx_size) {
+        obj->exidx_start = exidx_vaddr + obj->bias;
+        obj->exidx_end = obj->exidx_start + exidx_size;
+        obj->exidx_offset = exidx_offset;
     }
 }
 
-/* 
- * fill in the exidx_start and _end fills in the mapinfo structures
- * based on ELF headers found in the executable sections
- * */
-static void parse_exidx_info(pid_t pid, mapinfo *milist)
+/*
+ * read the headers of every object in the table, for the build-ids in
+ * the memory maps.  This is a read or two of the first page of each.
+ */
+static void read_object_headers(memreader *mr, maptable *milist)
 {
-    mapinfo *mi;
     int i;
 
-    //LOG("Scanning for EXIDX info...\n");
-    for (mi = milist; mi != NULL; mi = mi->next) {
-        Elf32_Ehdr ehdr;
-
-        memset(&ehdr, 0, sizeof(ehdr));
-        /* Read in sizeof(Elf32_Ehdr) worth of data from the beginning of 
-         * mapped section.
-         */
-	//LOG("Scanning at 0x%08lx:\n", mi->start);
-        get_remote_struct(pid, (void *) (mi->start), &ehdr, 
-                          sizeof(ehdr));
-	//LOG("sizeof(ehdr)= %d\n", sizeof(ehdr));
-	//LOG("contents of (ehdr):\n");
-	/*for(i=0; i<sizeof(ehdr)/4; i+=4) {
-		char *s = ((void *)&ehdr)+i;
-		LOG(" %x %x %x %x - %c %c %c %c\n",
-			*s, *(s+1), *(s+2), *(s+3),
-			*s, *(s+1), *(s+2), *(s+3));
-	}
-	*/
-
-        /* Check if it has the matching magic words */
-        if (IS_ELF(ehdr)) {
-	    //LOG("Found ELF header in section %s!\n", mi->name);
-            Elf32_Phdr phdr;
-            Elf32_Phdr *ptr;
-            int i;
-
-            ptr = (Elf32_Phdr *) (mi->start + ehdr.e_phoff);
-            for (i = 0; i < ehdr.e_phnum; i++) {
-                /* Parse the program header */
-                get_remote_struct(pid, (void *) ptr+i, &phdr, 
-                                  sizeof(Elf32_Phdr));
-                /* Found a EXIDX segment? */
-                if (phdr.p_type == PT_ARM_EXIDX) {
-	    	    //LOG("Found EXIDX segment in section %s!\n", mi->name);
-                    mi->exidx_start = mi->start + phdr.p_offset;
-                    mi->exidx_end = mi->exidx_start + phdr.p_filesz;
-                    break;
-                }
-            }
+    for (i = 0; milist && i < milist->nobj; i++) {
+        if (!milist->obj[i].parsed) {
+            parse_elf_object(mr, &milist->obj[i]);
+            milist->obj[i].parsed = 1;
+        }
+    }
+}
+
+/*
+ * get_elfobj - the object behind a map, with its headers parsed and its
+ * unwind tables set up.  The tables are only looked for the first time
+ * an unwinder lands in the object, since a backtrace only touches a few.
+ * An object whose headers gave a build-id is looked up in the unwind
+ * cache before its file is even opened.  Otherwise the file is mapped
+ * and the cache tried under the key that gives it; failing that, the
+ * tables are used from the file (and saved in the cache) if it can be
+ * found, and are otherwise read from the process.
+ */
+const elfobj *get_elfobj(memreader *mr, maptable *mt, mapinfo *mi)
+{
+    elfobj *obj;
+
+    if (!mi || !mi->obj) {
+        return NULL;
+    }
+    obj = mi->obj;
+    if (!obj->parsed) {
+        parse_elf_object(mr, obj);
+        obj->parsed = 1;
+    }
+    if (!obj->tables_tried) {
+        obj->tables_tried = 1;
+        unwind_cache_key(obj, NULL);
+        if (unwind_cache_load(obj) == 0) {
+            DLOG("unwind cache hit for %s\n", obj->name);
+        } else if (map_elf_file(mt, mi) == 0 && !obj->build_id_len &&
+                   unwind_cache_load(obj) == 0) {
+            DLOG("unwind cache hit for %s\n", obj->name);
+        } else if (use_elf_file_tables(mr, obj) == 0) {
+            unwind_cache_store(obj);
         }
     }
+    return obj;
+}
+
+/* sp of frame n, or 0 if the unwinder didn't get that far */
+static unsigned frame_sp(const frametable *frames, int n)
+{
+    return n < frames->count ? frames->frame[n].sp : 0;
+}
+
+/* Follow the frame pointers for as long as they hold up, then the unwind
+ * tables for as long as they last, and find the rest of the frames by
+ * scanning the stack from where they ran out.
+ */
+static int hybrid_unwind_backtrace(memreader *mr, maptable *map,
+                                   frametable *frames, int *frame0_pc_sane)
+{
+#if USE_FP_UNWINDER
+    struct pt_regs regs;
+
+    fp_unwind_backtrace(mr, map, frames, FP_FRAME_LAYOUT_APCS, &regs,
+                        frame0_pc_sane);
+    if (frames->stop != FRAMES_BAD_LINK) {
+        return frames->count;
+    }
+    /* with no links followed, the tables do better from the registers */
+    if (frames->count > 1) {
+        table_unwind_continue(mr, map, frames, &regs);
+    } else {
+        frametable_clear(frames);
+        table_unwind_backtrace_with_ptrace(mr, map, frames, frame0_pc_sane);
+    }
+#else
+    table_unwind_backtrace_with_ptrace(mr, map, frames, frame0_pc_sane);
+#endif
+    if (frames->stop == FRAMES_NO_TABLE) {
+        guess_unwind_continue(mr, map, frames, frames->stop_sp);
+    }
+    return frames->count;
 }
 
-void dump_stack_and_code(int pid, mapinfo *map, 
-                         int unwind_depth, unsigned int sp_list[],
-                         int frame0_pc_sane)
+void dump_stack_and_code(memreader *mr, maptable *map, 
+                         const frametable *frames, int frame0_pc_sane)
 {
-    unsigned int sp, pc, p, end, data;
+    unsigned int sp, pc, p;
     struct pt_regs r;
-    int sp_depth;
+    stackdump sd;
 
-    if(ptrace(PTRACE_GETREGS, pid, 0, &r)) return;
+    if(mr_get_regs(mr, &r)) return;
     sp = r.ARM_sp;
     pc = r.ARM_pc;
 
@@ -501,91 +752,42 @@ void dump_stack_and_code(int pid, mapinfo *map,
         pc = r.ARM_lr;
     }
 
-    LOG("[code]\n");
-
-    end = p = pc & ~3;
-    p -= 16;
+    memset(&sd, 0, sizeof(sd));
+    sd.code_addr = (pc & ~3) - 16;
+    mr_read_struct(mr, sd.code_addr, sd.code, sizeof(sd.code));
 
-    /* Dump the code as:
-     *  PC         contents
-     *  00008d34   fffffcd0 4c0eb530 b0934a0e 1c05447c
-     *  00008d44   f7ff18a0 490ced94 68035860 d0012b00
+    sd.start = (sp - 64) & ~3;
+    /* stop at the first STACK_CONTENT_DEPTH frames, however many the
+     * unwinder found
      */
-    while (p <= end) {
-        int i;
-
-        LOG(" %08x  ", p);
-        for (i = 0; i < 4; i++) {
-            data = ptrace(PTRACE_PEEKTEXT, pid, (void*)p, NULL);
-            LOG(" %08x", data);
-            p += 4;
-        }
-        LOG("\n", p);
-    }
-
-    p = sp - 64;
-    p &= ~3;
-    if (unwind_depth != 0) {
-        if (unwind_depth < STACK_CONTENT_DEPTH) {
-            end = sp_list[unwind_depth-1];
+    if (frames->count != 0) {
+        if (frames->count < STACK_CONTENT_DEPTH) {
+            sd.end = frame_sp(frames, frames->count-1);
         }
         else {
-            end = sp_list[STACK_CONTENT_DEPTH-1];
+            sd.end = frame_sp(frames, STACK_CONTENT_DEPTH-1);
         }
     }
     else {
-        end = sp | 0x000000ff;
-        end += 0xff;
+        sd.end = sp | 0x000000ff;
+        sd.end += 0xff;
     }
-    LOG("\n");
-
-    LOG("[stack dump]\n");
-
-    /* If the crash is due to PC == 0, there will be two frames that
-     * have identical SP value.
-     */
-    if (sp_list[0] == sp_list[1]) {
-        sp_depth = 1;
-    }
-    else {
-        sp_depth = 0;
-    }
-
-    while (p <= end) {
-         char *prompt; 
-         char level[16];
-         data = ptrace(PTRACE_PEEKTEXT, pid, (void*)p, NULL);
-         if (p == sp_list[sp_depth]) {
-             sprintf(level, "#%02d", sp_depth++);
-             prompt = level;
-         }
-         else {
-             prompt = "   ";
-         }
-         
-         LOG("%s %08x  %08x  %s\n", prompt, p, data, 
-              map_to_name(map, data, ""));
-         p += 4;
-    }
-    /* print another 64-byte of stack data after the last frame */
-
-    end = p+64;
-    while (p <= end) {
-         data = ptrace(PTRACE_PEEKTEXT, pid, (void*)p, NULL);
-         LOG("    %08x  %08x  %s\n", p, data, 
-              map_to_name(map, data, ""));
-         p += 4;
+    sd.nsp = frames->count < STACK_CONTENT_DEPTH ? frames->count :
+                                                   STACK_CONTENT_DEPTH;
+    for (p = 0; p < sd.nsp; p++) {
+        sd.sp[p] = frame_sp(frames, p);
     }
-
-    LOG("\n");
+    sd.mr = mr;
+    sd.read_word = mr_read_word;
+    write_stack_and_code(map, &sd);
 }
 
-void dump_pc_and_lr(int pid, mapinfo *map, int unwound_level)
+void dump_pc_and_lr(memreader *mr, maptable *map, int unwound_level)
 {
     struct pt_regs r;
 
-    if(ptrace(PTRACE_GETREGS, pid, 0, &r)) {
-        LOG("pid %d not responding!\n", pid);
+    if(mr_get_regs(mr, &r)) {
+        LOG("cannot get registers: %d (%s)\n", errno, strerror(errno));
         return;
     }
 
@@ -606,10 +808,10 @@ void dump_klog_tail()
 	int size;
 	int len;
 
-        LOG("[kernel log]\n");
+        report_section(report_fd, "kernel log");
 
 	size = klogctl(10, NULL, 0);
-	buffer = malloc(size);
+	buffer = arena_alloc(size);
 	if(!buffer) {
 		return;
 	}
@@ -627,43 +829,67 @@ void dump_klog_tail()
 	/* FIXTHIS - it would be good to filter out crash_handler
  	 * log messages here
  	 */
-	write(report_fd, start, len);
-	free(buffer);
+	if (report_binary) {
+		report_record(report_fd, REC_KLOG, start, len);
+	} else {
+		report_write(report_fd, start, len);
+	}
+	arena_free(buffer);
 }
 
 
-void dump_crash_report(unsigned pid, mapinfo *milist)
+void dump_crash_report(memreader *mr, maptable *milist)
 {
-    unsigned int sp_list[STACK_CONTENT_DEPTH];
+    frametable frames;
     int stack_depth;
     int frame0_pc_sane = 1;
-    
-    parse_exidx_info(pid, milist);
 
-    /* Clear stack pointer records */
-    memset(sp_list, 0, sizeof(sp_list));
+    memset(&frames, 0, sizeof(frames));
+    frames.limit = MAX_BACKTRACE_FRAMES;
 
-    LOG("[call stack]\n");
+    report_section(report_fd, "call stack");
+
+#if USE_HYBRID_UNWINDER
+    start_backtrace("hybrid");
+    stack_depth = hybrid_unwind_backtrace(mr, milist, &frames,
+                                          &frame0_pc_sane);
+    dump_backtrace(milist, &frames);
+    DLOG("stack_depth=%d\n", stack_depth);
+#else
+#if USE_FP_UNWINDER
+    {
+        struct pt_regs regs;
+
+        start_backtrace("frame pointer");
+        stack_depth = fp_unwind_backtrace(mr, milist, &frames,
+                                          FP_FRAME_LAYOUT_APCS, &regs,
+                                          &frame0_pc_sane);
+        dump_backtrace(milist, &frames);
+        DLOG("stack_depth=%d\n", stack_depth);
+    }
+#endif
 
 #if USE_TABLE_UNWINDER
-    LOG("= table unwinder =\n");
-    stack_depth = table_unwind_backtrace_with_ptrace(pid, milist, sp_list,
+    frametable_clear(&frames);
+    start_backtrace("table");
+    stack_depth = table_unwind_backtrace_with_ptrace(mr, milist, &frames,
                                                &frame0_pc_sane);
+    dump_backtrace(milist, &frames);
     DLOG("stack_depth=%d\n", stack_depth);
 #endif
 
 #if USE_GUESS_UNWINDER
-    memset(sp_list, 0, sizeof(sp_list));
-    LOG("= best-guess unwinder =\n");
-    stack_depth = guess_unwind_backtrace_with_ptrace(pid, milist, sp_list,
+    frametable_clear(&frames);
+    start_backtrace("best-guess");
+    stack_depth = guess_unwind_backtrace_with_ptrace(mr, milist, &frames,
                                                &frame0_pc_sane);
     DLOG("stack_depth=%d\n", stack_depth);
 #endif
+#endif /* USE_HYBRID_UNWINDER */
 
 #if USE_MCTERNAN_UNWINDER
-    /* FIXTHIS - could put mcternan unwinder here */
-    LOG("= McTernan unwinder =\n");
-    LOG("Unwinder not integrated yet... - sorry\n");
+    start_backtrace("McTernan");
+    mcternan_unwind_backtrace(mr, milist, MAX_BACKTRACE_FRAMES);
 #endif
 
     LOG("\n");
@@ -676,26 +902,36 @@ void dump_crash_report(unsigned pid, mapinfo *milist)
      * level is seen we make sure at least pc and lr are dumped.
      */
     if (stack_depth < 2) {
-        dump_pc_and_lr(pid, milist, stack_depth);
+        dump_pc_and_lr(mr, milist, stack_depth);
     }
 
-    dump_stack_and_code(pid, milist, stack_depth, sp_list, frame0_pc_sane);
-
-    dump_klog_tail();
+    dump_stack_and_code(mr, milist, &frames, frame0_pc_sane);
+    frametable_clear(&frames);
 }
 
 int generate_crash_report(pid_t pid, unsigned sig, unsigned uid, unsigned gid)
 {
-    mapinfo *milist;
+    maptable *milist;
+    memreader *mr;
     int attach_status = -1;
     int result, status;
 
+    /* get all the memory we will need up front, before the crashed
+     * process (and whatever else is running) can use it up
+     */
+    arena_init(ARENA_SIZE, ARENA_MLOCK);
+#if DO_UNWIND_CACHE
+    unwind_cache_init(UNWIND_CACHE_DIR, UNWIND_CACHE_SIZE);
+#endif
+
+    if (report_binary) {
+        unsigned magic = REPORT_MAGIC;
+
+        report_record(report_fd, REC_START, &magic, sizeof(magic));
+    }
     dump_task_info(pid, sig, uid, pid); /* uses /proc */
 
-    LOG("[memory maps]\n");
-    /* get_mapinfo_list retrieves list and outputs to LOG */
     milist = get_mapinfo_list(pid); /* uses /proc */
-    LOG("\n");
 
     attach_status = ptrace(PTRACE_ATTACH, pid, 0, 0);
     if(attach_status < 0) {
@@ -704,24 +940,77 @@ int generate_crash_report(pid_t pid, unsigned sig, unsigned uid, unsigned gid)
 	DLOG("ptrace attach to pid %d succeeded\n", pid);
     }
 
+    /* the stack snapshot, and the unwind tables from disk, sit in front
+     * of the live process
+     */
+    mr = open_live_reader(pid, milist); /* uses ptrace */
+    mr = open_snapshot_reader(open_elf_reader(milist, mr));
+    snapshot_stack(mr);
+
+    /* the maps are written out once the build-ids have been read */
+    read_object_headers(mr, milist);
+    report_section(report_fd, "memory maps");
+    write_memory_maps(milist);
+    LOG("\n");
+    report_flush();
+
     if (sig) {
 	dump_fault_addr(pid, sig); /* uses ptrace */
     }
 
-    dump_registers(pid); /* uses ptrace */
-    dump_pc_code(pid); /* uses ptrace */
+    dump_registers(mr, milist);
+    dump_pc_code(mr);
 
-    dump_crash_report(pid, milist);
+    dump_crash_report(mr, milist);
+    report_flush();
+    dump_klog_tail();
     
+    LOG("arena used: %u of %u bytes\n", (unsigned)arena_high_water(),
+        (unsigned)arena_size());
     LOG("--- done ---\n");
+    report_flush();
     
     if (attach_status == 0 ) {
 	int detach_status;
 	detach_status = ptrace(PTRACE_DETACH, pid, 0, 0);
     }
-    free_mapinfo_list(milist);
+    free_maptable(milist);
+    mr_close(mr);
+    arena_release();
+    return 0;
 }
 
+/*
+ * generate_core_report - run the report (minus the parts that need the
+ * live process) over a saved core file, writing it to stdout
+ */
+int generate_core_report(const char *path)
+{
+    maptable *milist;
+    memreader *core, *mr;
+
+    core = open_core_reader(path);
+    if (!core) {
+        fprintf(stderr, "Could not read core file %s\n", path);
+        return -1;
+    }
+    report_fd = STDOUT_FILENO;
+
+    milist = get_core_mapinfo_list(core);
+    mr = open_snapshot_reader(open_elf_reader(milist, core));
+    snapshot_stack(mr);
+
+    dump_registers(mr, milist);
+    dump_pc_code(mr);
+    dump_crash_report(mr, milist);
+
+    LOG("--- done ---\n");
+    report_flush();
+
+    free_maptable(milist);
+    mr_close(mr);
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
@@ -736,6 +1025,8 @@ int main(int argc, char *argv[])
     char path[128];
     int core_out_fd;
 
+    report_init(report_buffer, sizeof(report_buffer));
+
     /* check for install argument */
     if (argc==2 && strcmp(argv[1], "--install")==0) {
         char actualpath[PATH_MAX];
@@ -768,6 +1059,12 @@ int main(int argc, char *argv[])
 	printf("crash_handler v%d.%d\n", VERSION, REVISION);
 	return 0;
     }
+    if (argc==3 && strcmp(argv[1], "--core")==0) {
+	return generate_core_report(argv[2]) ? 1 : 0;
+    }
+    if (argc==3 && strcmp(argv[1], "--render")==0) {
+	return render_report(argv[2], STDOUT_FILENO) ? 1 : 0;
+    }
 
     if (argc<3) {
         printf("Usage: crash_handler <pid> <sid> <uid> <gid>\n\n");
@@ -780,7 +1077,13 @@ int main(int argc, char *argv[])
 	printf("            That is, to install the crash_handler program\n");
 	printf("            on a system, copy the program to /tmp and do:\n");
 	printf("              $ /tmp/crash_handler --install\n");
-	printf("--version   show version information\n\n");
+	printf("--version   show version information\n");
+	printf("--core <file>\n");
+	printf("            Write a report for an ELF core file to stdout,\n");
+	printf("            instead of for a live process.\n");
+	printf("--render <file>\n");
+	printf("            Write a binary crash report out as text, to\n");
+	printf("            stdout.\n\n");
 	return -1;
     }
 
@@ -791,6 +1094,8 @@ int main(int argc, char *argv[])
     gid = atoi(argv[4]);
 
     report_fd = find_and_open_crash_report();
+    report_binary = REPORT_BINARY;
+    report_json = REPORT_JSON && !REPORT_BINARY;
 
     /* start of crash handling stuff */
     /* this MUST be done before reading the core from standard in */
@@ -817,6 +1122,7 @@ int main(int argc, char *argv[])
     }
 #endif	/* DO_CORE_FILE */
 
+    report_flush();
     if( report_fd >= 0 ) {
 	close(report_fd);
     }
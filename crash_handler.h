@@ -21,12 +21,23 @@
 #define CRASH_HANDLER_DEBUG 0
 
 #include "utility.h" /* needed for mapinfo */
+#include "report-render.h" /* report_out(), and dump_backtrace() */
 
-extern int report_fd;
-extern void report_out(int rfd, const char *fmt, ...);
 extern mapinfo stack_map;
+extern stack_snapshot crash_stack;
 extern void klog_fmt(const char *fmt, ...);
 
+struct memreader;
+/* the object behind mi, with its ELF headers parsed on first use */
+extern const elfobj *get_elfobj(struct memreader *mr, maptable *mt,
+                                mapinfo *mi);
+
+/* top of the stack that sp is in: the end of the snapshot if sp is in it */
+extern unsigned stack_top(unsigned sp);
+
+/* the call instruction that a return address comes back to */
+extern unsigned return_to_call_site(struct memreader *mr, unsigned ret);
+
 #define LOG(fmt...) report_out(report_fd, fmt)
 #if CRASH_HANDLER_DEBUG
 /* choose either tombstone or klog output for debug
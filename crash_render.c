@@ -0,0 +1,47 @@
+/*
+ * crash_render.c - turn binary crash reports back into text, on a host
+ *
+ * Copyright 2011,2012 Sony Network Entertainment
+ *
+ * This is "crash_handler --render" on its own, built from the parts of
+ * crash_handler that don't need ARM or ptrace, for reading reports that
+ * have been copied off the device.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "report-render.h"
+
+#define REPORT_BUFFER_SIZE	(64*1024)
+
+static char report_buffer[REPORT_BUFFER_SIZE];
+
+int main(int argc, char *argv[])
+{
+    int i, failed = 0;
+
+    if (argc < 2) {
+        printf("Usage: crash_render <report> ...\n\n");
+        printf("Write binary crash reports out as text, to stdout.\n");
+        return 1;
+    }
+
+    report_init(report_buffer, sizeof(report_buffer));
+    for (i = 1; i < argc; i++) {
+        failed |= render_report(argv[i], STDOUT_FILENO) != 0;
+    }
+    return failed;
+}
@@ -0,0 +1,265 @@
+/*
+ * elf-reader.c - memory reader over the ELF files behind the maps
+ *
+ * Copyright 2011,2012 Sony Network Entertainment
+ *
+ * The table unwinder spends most of its reads in the .ARM.exidx and
+ * .ARM.extab sections: a binary search of the index for every frame, and
+ * then the unwind instructions.  Those sections are never written to, so
+ * when an object is first looked at its file is mapped read-only, and
+ * this reader serves them from there (or from the unwind cache), instead
+ * of from the crashed process.  Anything else, or any object whose file
+ * can't be found (or doesn't match what is in memory), is left to the
+ * next reader.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "memreader.h"
+#include "arena.h"
+#include "unwind-cache.h"
+#include "crash_handler.h"
+
+#define EXIDX_ENTRY_SIZE	8
+
+typedef struct elf_reader {
+    memreader mr;
+    maptable *map;
+} elf_reader;
+
+/* Open the file behind mi.  map_files works even when the file has been
+ * deleted or replaced since it was mapped, but only for a live process
+ * (and only for root), so fall back to the name in the maps.
+ */
+static int open_object_file(maptable *mt, const mapinfo *mi, int *trusted)
+{
+    char path[64];
+    int fd;
+
+    if (mt->pid) {
+        snprintf(path, sizeof(path), "/proc/%d/map_files/%x-%x",
+                 mt->pid, mi->start, mi->end);
+        fd = open(path, O_RDONLY);
+        if (fd >= 0) {
+            *trusted = 1;
+            return fd;
+        }
+    }
+    if (mi->name[0] != '/' || strstr(mi->name, " (deleted)")) {
+        return -1;
+    }
+    *trusted = 0;
+    return open(mi->name, O_RDONLY);
+}
+
+int map_elf_file(maptable *mt, mapinfo *mi)
+{
+    elfobj *obj = mi->obj;
+    struct stat sb;
+    void *image;
+    int fd, trusted;
+
+    fd = open_object_file(mt, mi, &trusted);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &sb) || sb.st_size < sizeof(Elf32_Ehdr)) {
+        close(fd);
+        return -1;
+    }
+    image = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        return -1;
+    }
+    if (memcmp(image, ELFMAG, SELFMAG) != 0) {
+        munmap(image, sb.st_size);
+        return -1;
+    }
+
+    obj->image = image;
+    obj->image_size = sb.st_size;
+    obj->image_trusted = trusted;
+    unwind_cache_key(obj, &sb);
+    return 0;
+}
+
+/* Find .ARM.extab in the section headers, if the file still has them */
+static void find_extab(elfobj *obj)
+{
+    const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *)obj->image;
+    const Elf32_Shdr *shdr, *strtab;
+    const char *name;
+    int i;
+
+    if (ehdr->e_shoff == 0 || ehdr->e_shstrndx >= ehdr->e_shnum ||
+        ehdr->e_shentsize != sizeof(Elf32_Shdr) ||
+        ehdr->e_shoff + ehdr->e_shnum * sizeof(Elf32_Shdr) > obj->image_size) {
+        return;
+    }
+    shdr = (const Elf32_Shdr *)(obj->image + ehdr->e_shoff);
+    strtab = &shdr[ehdr->e_shstrndx];
+
+    for (i = 0; i < ehdr->e_shnum; i++) {
+        if (strtab->sh_offset + shdr[i].sh_name + sizeof(".ARM.extab") >
+            obj->image_size) {
+            continue;
+        }
+        name = (const char *)obj->image + strtab->sh_offset + shdr[i].sh_name;
+        if (strcmp(name, ".ARM.extab") == 0 &&
+            shdr[i].sh_type == SHT_PROGBITS &&
+            shdr[i].sh_offset + shdr[i].sh_size <= obj->image_size) {
+            obj->extab_start = shdr[i].sh_addr + obj->bias;
+            obj->extab_end = obj->extab_start + shdr[i].sh_size;
+            obj->extab_data = obj->image + shdr[i].sh_offset;
+            return;
+        }
+    }
+}
+
+/* Decode the start of the function of every EXIDX entry into a plain
+ * sorted array of link-time addresses, so that lookups don't have to
+ * decode prel31 offsets on every probe.
+ */
+static void build_fn_index(elfobj *obj)
+{
+    unsigned *fn;
+    unsigned i, count, word, link;
+
+    count = (obj->exidx_end - obj->exidx_start) / EXIDX_ENTRY_SIZE;
+    if (count == 0) {
+        return;
+    }
+    fn = arena_alloc(count * sizeof(unsigned));
+    if (!fn) {
+        return;
+    }
+    link = obj->exidx_start - obj->bias;
+    for (i = 0; i < count; i++) {
+        memcpy(&word, obj->exidx_data + i * EXIDX_ENTRY_SIZE, sizeof(word));
+        /* sign extend the 31-bit self-relative offset */
+        if (word & (1u << 30)) {
+            word |= 1u << 31;
+        } else {
+            word &= ~(1u << 31);
+        }
+        fn[i] = link + i * EXIDX_ENTRY_SIZE + word;
+        if (i && fn[i] < fn[i-1]) {
+            /* not sorted, so no use for a binary search */
+            arena_free(fn);
+            return;
+        }
+    }
+    obj->fn_index = fn;
+    obj->fn_count = count;
+}
+
+int use_elf_file_tables(memreader *mr, elfobj *obj)
+{
+    unsigned char entry[EXIDX_ENTRY_SIZE];
+    unsigned size = obj->exidx_end - obj->exidx_start;
+
+    if (!obj->image || size == 0 ||
+        obj->exidx_offset + size > obj->image_size) {
+        return -1;
+    }
+
+    /* A file opened by name may not be the one that was loaded.  If the
+     * first index entry in memory can be read, it must match.  (It may
+     * well not be there in a core file, which is when the file is most
+     * useful.)
+     */
+    if (!obj->image_trusted &&
+        mr_read(mr, obj->exidx_start, entry, sizeof(entry)) == sizeof(entry) &&
+        memcmp(entry, obj->image + obj->exidx_offset, sizeof(entry)) != 0) {
+        DLOG("elf reader: %s does not match memory\n", obj->name);
+        return -1;
+    }
+
+    obj->exidx_data = obj->image + obj->exidx_offset;
+    find_extab(obj);
+    build_fn_index(obj);
+    return 0;
+}
+
+/* Copy what of [addr, addr+size) falls in one table, at the start */
+static size_t read_table(unsigned start, unsigned end,
+                         const unsigned char *data, unsigned addr, void *dst,
+                         size_t size)
+{
+    size_t chunk;
+
+    if (!data || addr < start || addr >= end) {
+        return 0;
+    }
+    chunk = end - addr;
+    if (chunk > size) {
+        chunk = size;
+    }
+    memcpy(dst, data + (addr - start), chunk);
+    return chunk;
+}
+
+static size_t elf_read(memreader *mr, unsigned addr, void *dst, size_t size)
+{
+    elf_reader *er = (elf_reader *)mr;
+    mapinfo *mi;
+    elfobj *obj;
+    size_t done;
+
+    /* only objects whose tables have been set up are of interest */
+    mi = find_mapinfo(er->map, addr);
+    if (!mi || !mi->obj || !mi->obj->tables_tried) {
+        return 0;
+    }
+    obj = mi->obj;
+
+    done = read_table(obj->exidx_start, obj->exidx_end, obj->exidx_data,
+                      addr, dst, size);
+    if (done == 0) {
+        done = read_table(obj->extab_start, obj->extab_end, obj->extab_data,
+                          addr, dst, size);
+    }
+    return done;
+}
+
+static void elf_close(memreader *mr)
+{
+    /* the mapped files belong to the map table */
+    arena_free(mr);
+}
+
+memreader *open_elf_reader(maptable *map, memreader *next)
+{
+    elf_reader *er;
+
+    er = arena_calloc(1, sizeof(elf_reader));
+    if (!er) {
+        return next;
+    }
+    er->mr.read = elf_read;
+    er->mr.close = elf_close;
+    er->mr.next = next;
+    er->map = map;
+
+    return &er->mr;
+}
@@ -0,0 +1,173 @@
+/*
+ * fp-unwinder.c - backtrace from the chain of frame pointers
+ *
+ * Copyright 2011,2012 Sony Network Entertainment
+ *
+ * Code built with frame pointers keeps a linked list of frame records on
+ * the stack, each holding the caller's frame pointer and the return
+ * address.  Following it takes one small read from the stack snapshot per
+ * frame, so where the chain is whole it is by far the quickest backtrace
+ * there is.  Each link is checked before it is followed, and the walk stops
+ * at the first one that doesn't hold up (code built with
+ * -fomit-frame-pointer, or using the register for something else), for the
+ * unwind tables to carry on from.
+ *
+ * The frame pointer is r11 in ARM code and r7 in Thumb code.  Two layouts
+ * of frame record are understood:
+ *   APCS (-mapcs-frame): fp points at the saved pc, with the return
+ *       address at fp-4, the caller's sp at fp-8 and its fp at fp-12
+ *   AAPCS: an {fp, lr} pair; gcc points fp at the lr word of it and clang
+ *       at the fp word, so both are tried
+ *
+ * A function that sets up no frame record of its own (a leaf, in
+ * optimised code) doesn't show up in the chain.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <asm/ptrace.h>
+
+#include "utility.h"
+#include "memreader.h"
+#include "crash_handler.h"
+
+#ifndef PSR_T_BIT
+#define PSR_T_BIT 0x00000020
+#endif
+
+/* What a frame record says about the caller */
+typedef struct fplink {
+    unsigned fp;
+    unsigned sp;
+    unsigned ret;   /* return address into it */
+} fplink;
+
+/* A caller's frame pointer is further up the stack, or 0 in the outermost
+ * frame.
+ */
+static int good_fp(unsigned next, unsigned fp, unsigned top)
+{
+    return next == 0 || (next > fp && next < top && (next & 3) == 0);
+}
+
+/* A return address has to come back to code in the same mode, as the
+ * caller's frame pointer is in a different register otherwise.
+ */
+static int good_return(maptable *map, unsigned ret, int thumb)
+{
+    if ((ret & 1) != thumb || (!thumb && (ret & 3))) {
+        return 0;
+    }
+    return addr_in_code(map, (ret & ~1) - 2);
+}
+
+/* Read the frame record at fp.  Returns 1 if it holds up. */
+static int read_link(memreader *mr, maptable *map, unsigned fp, unsigned top,
+                     int thumb, int apcs, fplink *link)
+{
+    unsigned rec[3];
+
+    if (apcs) {
+        /* APCS frames are ARM only; the saved sp is always fp + 4 */
+        if (thumb || mr_read(mr, fp - 12, rec, 12) != 12 ||
+            rec[1] != fp + 4 || !good_fp(rec[0], fp, top) ||
+            !good_return(map, rec[2], thumb)) {
+            return 0;
+        }
+        link->fp = rec[0];
+        link->sp = rec[1];
+        link->ret = rec[2];
+        return 1;
+    }
+
+    /* gcc: fp at the lr word.  [fp] can't be both a code address and a
+     * stack one, so at most one of the two layouts fits.
+     */
+    if (mr_read(mr, fp - 4, rec, 8) == 8 &&
+        good_fp(rec[0], fp, top) && good_return(map, rec[1], thumb)) {
+        link->fp = rec[0];
+        link->sp = fp + 4;
+        link->ret = rec[1];
+        return 1;
+    }
+    /* clang: fp at the fp word */
+    if (mr_read(mr, fp, rec, 8) == 8 &&
+        good_fp(rec[0], fp, top) && good_return(map, rec[1], thumb)) {
+        link->fp = rec[0];
+        link->sp = fp + 8;
+        link->ret = rec[1];
+        return 1;
+    }
+    return 0;
+}
+
+/* Walk the frame pointer chain into frames.  regs is left with the
+ * registers of the last frame added, as far as they are known, for the
+ * table unwinder to carry on from if the chain breaks (frames->stop is
+ * FRAMES_BAD_LINK then).  A frame pointer of 0 only ends the chain once
+ * a link has been followed; at the crash it is more likely code built
+ * without frame pointers, so that counts as a broken chain too.
+ * Return the level of stack it unwinds.
+ */
+int fp_unwind_backtrace(memreader *mr, maptable *map, frametable *frames,
+                        int apcs, struct pt_regs *regs, int *frame0_pc_sane)
+{
+    fplink link;
+    unsigned fp, top;
+    int thumb, reg, added;
+
+    if (mr_get_regs(mr, regs)) {
+        return 0;
+    }
+    thumb = (regs->ARM_cpsr & PSR_T_BIT) != 0;
+    reg = thumb ? 7 : 11;
+    top = stack_top(regs->ARM_sp);
+    *frame0_pc_sane = addr_in_code(map, regs->ARM_pc);
+
+    frames->stop = FRAMES_END;
+    frames->stop_pc = regs->ARM_pc;
+    frames->stop_sp = regs->ARM_sp;
+    added = frametable_add(frames, regs->ARM_pc & ~1, regs->ARM_sp, FRAME_FP);
+    if (added == 0 && regs->uregs[reg] == 0) {
+        frames->stop = FRAMES_BAD_LINK;
+        return frames->count;
+    }
+    while (added == 0 && regs->uregs[reg] != 0) {
+        fp = regs->uregs[reg];
+        frames->stop_pc = regs->ARM_pc;
+        frames->stop_sp = regs->ARM_sp;
+
+        /* the record has to be in the stack, above sp */
+        if ((fp & 3) || fp < regs->ARM_sp || fp < 12 || top < 8 ||
+            fp > top - 8 ||
+            !read_link(mr, map, fp, top, thumb, apcs, &link)) {
+            frames->stop = FRAMES_BAD_LINK;
+            return frames->count;
+        }
+        DLOG("fp %08x: caller fp %08x sp %08x ret %08x\n", fp, link.fp,
+             link.sp, link.ret);
+
+        regs->uregs[reg] = link.fp;
+        regs->ARM_sp = link.sp;
+        regs->ARM_pc = link.ret;
+        added = frametable_add(frames, return_to_call_site(mr, link.ret),
+                               link.sp, FRAME_FP);
+    }
+
+    if (added > 0) {
+        frames->stop = FRAMES_LOOP;
+    } else if (added < 0) {
+        frames->stop = FRAMES_LIMIT;
+    }
+    return frames->count;
+}
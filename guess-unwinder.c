@@ -8,11 +8,17 @@
  * How hard can it be to write an unwinder from scratch, using
  * guesswork and heuristics on the stack and code?...
  */
+#include <string.h>
 #include <sys/ptrace.h>
 #include <asm/ptrace.h>
 #include "utility.h"
+#include "memreader.h"
+#include "stack-scan.h"
 #include "crash_handler.h"
 
+/* stack words fetched and filtered at a time */
+#define SCAN_CHUNK_WORDS	1024
+
 /* test for branch and link */
 #define is_ARM_bl(ins)	((ins & 0x0f000000) >> 24)==0x0b
 
@@ -20,102 +26,299 @@
 
 /* calculate the offset of the branch, from the instruction value
  * mask off lower 24 bits (the offset),
- * sign-extend by OR-ing with some 1 bits multiplied by the sign-bit
+ * sign-extend by OR-ing with some 1 bits multiplied by the sign-bit (bit 23)
  * multiply by 4 (to convert to word address)
  * and add 8 (to account for instruction pipelining)
  */
 #define branch_offset(ins) ((int)((unsigned int)((ins & 0x00ffffff) | \
-	(0xff000000 * ((ins & 0x01000000) >> 24)))<<2)+8)
+	(0xff000000 * ((ins & 0x00800000) >> 23)))<<2)+8)
 
 #define branch_target(p, ins)	((unsigned int)((int)p + branch_offset(ins)))
 
-/* routine to determine if a word value represents a return address
- * This routine checks to see if the word value points to an address that
- * immediately follows a branch instruction.
+/* ARM BLX <imm> (unconditional space) and BLX <reg> */
+#define is_ARM_blx_imm(ins)	(((ins) & 0xfe000000) == 0xfa000000)
+#define is_ARM_blx_reg(ins)	(((ins) & 0x0ffffff0) == 0x012fff30)
+
+/* Thumb BLX <reg>, and the two halves of Thumb-2 BL and BLX <imm> */
+#define is_Thumb_blx_reg(hw)	(((hw) & 0xff87) == 0x4780)
+#define is_Thumb_bl_hw1(hw)	(((hw) & 0xf800) == 0xf000)
+#define is_Thumb_bl_hw2(hw)	(((hw) & 0xd000) == 0xd000)
+#define is_Thumb_blx_hw2(hw)	(((hw) & 0xd001) == 0xc000)
+
+/* Target of a Thumb-2 BL or BLX <imm> at addr:
+ * offset = SignExtend(S:I1:I2:imm10:imm11:0), with I1 = ~(J1 ^ S) and
+ * I2 = ~(J2 ^ S).  BLX goes to ARM code, so its base is word aligned.
  */
-int is_ARM_return_address(int pid, mapinfo *milist, unsigned int value)
+static unsigned int thumb_branch_target(unsigned int addr, unsigned int hw1,
+	unsigned int hw2)
 {
-	unsigned int addr;
-	unsigned int data;
-	unsigned int rel_addr;
-	const mapinfo *mi;
-
-	/* check 4 bytes before the address */
-	addr = value-4;
-
-	/* FIXTHIS - check map to see if this is in text segment */
-	rel_addr = addr;
-	mi = pc_to_mapinfo(milist, addr, &rel_addr);
-	if (mi == NULL) {
-		/* address is not in the executable memory map */
-		/* note that the [stack] map is not executable,
- 		 * and has already been filtered from the map list
- 		*/
-		return 0;
+	unsigned int s, i1, i2, offset;
+
+	s = (hw1 >> 10) & 1;
+	i1 = !(((hw2 >> 13) & 1) ^ s);
+	i2 = !(((hw2 >> 11) & 1) ^ s);
+	offset = (s << 24) | (i1 << 23) | (i2 << 22) |
+		((hw1 & 0x3ff) << 12) | ((hw2 & 0x7ff) << 1);
+	if (s) {
+		offset |= 0xfe000000;
+	}
+	if (is_Thumb_blx_hw2(hw2)) {
+		return ((addr + 4) & ~3) + offset;
+	}
+	return addr + 4 + offset;
+}
+
+/*
+ * Code cache.  Candidate return addresses tend to point into the same few
+ * functions, so code is fetched from the process a line at a time and kept
+ * for the rest of the scan, rather than peeked a word at a time.
+ */
+#define CODE_LINE_SIZE	256
+#define CODE_LINES	64
+
+static struct code_line {
+	unsigned int addr;	/* 0 if unused */
+	unsigned int size;	/* bytes that could be read */
+	unsigned char data[CODE_LINE_SIZE];
+} code_cache[CODE_LINES];
+
+static void flush_code_cache(void)
+{
+	int i;
+
+	for (i = 0; i < CODE_LINES; i++) {
+		code_cache[i].addr = 0;
+	}
+}
+
+/* Copy size bytes of code at addr out of the code cache.
+ * Returns 0 if they could all be read.
+ */
+static int get_code(memreader *mr, unsigned int addr, void *dst, int size)
+{
+	struct code_line *line;
+	unsigned int base, offset, chunk;
+
+	while (size > 0) {
+		base = addr & ~(CODE_LINE_SIZE - 1);
+		offset = addr - base;
+		line = &code_cache[(base / CODE_LINE_SIZE) % CODE_LINES];
+		if (line->addr != base || base == 0) {
+			line->addr = base;
+			line->size = mr_read(mr, base, line->data, CODE_LINE_SIZE);
+		}
+		chunk = CODE_LINE_SIZE - offset;
+		if (chunk > size) {
+			chunk = size;
+		}
+		if (offset + chunk > line->size) {
+			return -1;
+		}
+		memcpy(dst, line->data + offset, chunk);
+		dst += chunk;
+		addr += chunk;
+		size -= chunk;
 	}
+	return 0;
+}
 
-	DLOG("checking addr=0x%08lx for instruction\n", addr);
+/* Work out whether a word value is a return address: whether it points
+ * just after a call in code.  The low bit says which: set for a return
+ * to Thumb code (BL, BLX <imm> and BLX <reg> in Thumb), clear for a
+ * return to ARM code (BL, BLX <imm> and BLX <reg> in ARM).
+ * On success the address of the call goes in *site, and the function it
+ * calls in *target (0 for a call through a register).
+ */
+static int find_call_site(memreader *mr, maptable *milist, unsigned int value,
+	unsigned int *site, unsigned int *target)
+{
+	unsigned int ret = value & ~1;
+	unsigned int ins;
+	unsigned short hw[2];
 
-	data = ptrace(PTRACE_PEEKTEXT, pid, (void*)addr, NULL);
+	/* note that the [stack] map is not executable, and has already
+	 * been filtered from the map list
+	 */
+	if (!addr_in_code(milist, ret-2)) {
+		return 0;
+	}
 
-	/* detect failure to read data from process memory */
-	if (data==0xffffffff) {
+	if (value & 1) {
+		if (!addr_in_code(milist, ret-4) ||
+		    get_code(mr, ret-4, hw, sizeof(hw))) {
+			/* maybe a 16-bit BLX at the very start of a map */
+			if (get_code(mr, ret-2, &hw[1], sizeof(hw[1]))) {
+				return 0;
+			}
+			hw[0] = 0;
+		}
+		DLOG("halfwords before %08x are %04x %04x\n", value, hw[0], hw[1]);
+		if (is_Thumb_bl_hw1(hw[0]) &&
+		    (is_Thumb_bl_hw2(hw[1]) || is_Thumb_blx_hw2(hw[1]))) {
+			*site = ret-4;
+			*target = thumb_branch_target(ret-4, hw[0], hw[1]);
+			return 1;
+		}
+		if (is_Thumb_blx_reg(hw[1])) {
+			*site = ret-2;
+			*target = 0;
+			return 1;
+		}
 		return 0;
 	}
 
-	DLOG("instruction at %08lx is %08lx\n", addr, data);
+	if (!addr_in_code(milist, ret-4) ||
+	    get_code(mr, ret-4, &ins, sizeof(ins))) {
+		return 0;
+	}
+	DLOG("instruction at %08lx is %08lx\n", ret-4, ins);
 
-	if (is_ARM_bl(data)) {	
-		DLOG("this instruction is a branch and link, with offset %d and target 0x%08x\n",
-			branch_offset(data), branch_target(addr, data));
+	*site = ret-4;
+	if (is_ARM_blx_imm(ins)) {
+		/* the H bit picks the halfword of the Thumb target */
+		*target = branch_target(ret-4, ins) | ((ins >> 23) & 2);
+		return 1;
+	}
+	if (is_ARM_bl(ins) && (ins >> 28) != 0xf) {
+		*target = branch_target(ret-4, ins);
 		return 1;
+	}
+	if (is_ARM_blx_reg(ins) && (ins >> 28) != 0xf) {
+		*target = 0;
+		return 1;
+	}
+	return 0;
+}
+
+/* routine to determine if a word value represents a return address
+ * This routine checks to see if the word value points to an address that
+ * immediately follows a branch instruction.
+ */
+int is_ARM_return_address(memreader *mr, maptable *milist, unsigned int value)
+{
+	unsigned int site, target;
+
+	return find_call_site(mr, milist, value, &site, &target);
+}
+
+/* Print one frame found by the scan */
+static void log_guess_frame(int frame_no, unsigned int exec_addr,
+	unsigned int func_addr)
+{
+	if (func_addr) {
+		LOG("#%d:0x%08lx in function 0x%08lx at offset 0x%lx\n",
+			frame_no, exec_addr, func_addr, exec_addr-func_addr);
 	} else {
-		return 0;
+		LOG("#%d:0x%08lx in function called through a register\n",
+			frame_no, exec_addr);
+	}
+}
+
+/* scan_stack()
+ * Look for return addresses on the stack, from sp up.  Each call site
+ * found is added to frames if there is a frame table, or else printed,
+ * numbered on from frame_no.
+ * returns number of the last frame found
+ */
+static int scan_stack(memreader *mr, maptable *milist, unsigned int sp,
+	frametable *frames, int frame_no)
+{
+	unsigned int addr, data;
+	unsigned int func_addr, exec_addr;
+	unsigned int base, end;
+	unsigned int words[SCAN_CHUNK_WORDS];
+	int hits[SCAN_CHUNK_WORDS];
+	codefilter filter;
+	int i, n, nhits;
+
+	/* back = 2 keeps Thumb return addresses just after a 16-bit BLX
+	 * at the very start of a map
+	 */
+	codefilter_init(&filter, milist, 2);
+	end = stack_top(sp);
+	for (base = sp; base < end; base += SCAN_CHUNK_WORDS*4) {
+		n = end - base;
+		if (n > SCAN_CHUNK_WORDS*4) {
+			n = SCAN_CHUNK_WORDS*4;
+		}
+		n = mr_read(mr, base, words, n) / 4;
+		nhits = codefilter_scan(&filter, words, n, hits);
+
+		for (i = 0; i < nhits; i++) {
+			sp = base + hits[i]*4;
+			data = words[hits[i]];
+			DLOG("checking value 0x%08lx at stack position 0x%08lx\n", data, sp);
+			if (!find_call_site(mr, milist, data, &addr, &func_addr)) {
+				continue;
+			}
+			DLOG("at sp=%08lx: possible return address 0x%08lx on stack\n",
+				sp, data);
+
+			/* determine function called by branch */
+			DLOG("called function is: 0x%08lx\n", func_addr);
+			exec_addr = addr;
+			DLOG("execution offset in function is: %08lx + 0x%x\n", func_addr,
+				exec_addr-func_addr);
+
+			if (frames) {
+				if (frametable_add(frames, exec_addr, sp,
+						   FRAME_GUESS) < 0) {
+					frames->stop = FRAMES_LIMIT;
+					return frame_no;
+				}
+				frame_no++;
+				continue;
+			}
+
+			frame_no++;
+
+			/* FIXTHIS - use pc_to_mapinfo() to find the section name */
+
+			log_guess_frame(frame_no, exec_addr, func_addr);
+		}
+	}
+	if (frames) {
+		frames->stop = FRAMES_END;
 	}
+
+	return frame_no;
 }
 
 /* guess_unwind_backtrace_with_ptrace()
  * returns number of frames found
  */
 
-int guess_unwind_backtrace_with_ptrace(int pid, mapinfo *milist,
-	unsigned int sp_list[], int *frame0_pc_sane)
+int guess_unwind_backtrace_with_ptrace(memreader *mr, maptable *milist,
+	frametable *frames, int *frame0_pc_sane)
 {
 	struct pt_regs r;
 
-	unsigned int sp, pc, lr, fp, p, addr, data;
+	unsigned int sp, pc, lr, fp, addr;
 	unsigned int func_addr, exec_addr;
-	unsigned int stack_size;
 	int frame_no;
-	int i;
 
 	/* move up stack looking at addresses */
 
 	/* set up regs for backtrace */
-	if (ptrace(PTRACE_GETREGS, pid, 0, &r)) return;
+	if (mr_get_regs(mr, &r)) return 0;
 	sp = r.ARM_sp;
 	pc = r.ARM_pc;
 	lr = r.ARM_lr;
 	fp = r.ARM_fp;
 
-	/* find out if LR points to an instruction after a BL */
+	flush_code_cache();
+
+	/* find out if LR points to an instruction after a call */
 	DLOG("lr=0x%08x\n", lr);
 
-	/* check 4 bytes before the address */
-	if (is_ARM_return_address(pid, milist, lr)) {
+	if (find_call_site(mr, milist, lr, &addr, &func_addr)) {
 		DLOG("lr points to a branch and link instruction\n");
 	} else {
 		DLOG("lr doesn't point to a branch link instruction\n");
 		return 0;
 	}
 
-	addr = lr-4;
-	data = ptrace(PTRACE_PEEKTEXT, pid, (void*)addr, NULL);
-
-	DLOG("addr+offset = 0x%08x\n", (int)(addr) + branch_offset(data));
-
 	/* determine function called by branch */
-	func_addr = branch_target(addr, data);
 	DLOG("called function is: 0x%08lx\n", func_addr);
 	exec_addr = pc;
 	DLOG("execution offset in function is: %08lx + 0x%x\n", func_addr,
@@ -125,10 +328,8 @@ int guess_unwind_backtrace_with_ptrace(int pid, mapinfo *milist,
 	exec_addr = pc;
 	frame_no = 0;
 
-	LOG("#%d:0x%08lx in function 0x%08lx at offset 0x%lx\n",
-		frame_no, exec_addr, func_addr, exec_addr-func_addr);
+	log_guess_frame(frame_no, exec_addr, func_addr);
 
-	/* start of loop */
 	/* desired output format(final):
 	 * <frame number>:<execution addr> in function <function_name> at <line_no>
 	 * desired output format(unprocessed):
@@ -136,34 +337,17 @@ int guess_unwind_backtrace_with_ptrace(int pid, mapinfo *milist,
 	 */
 
 	/* scan stack looking for return addresses */
-	stack_size = stack_map.end - sp;
-	for ( i=0; i<(stack_size/4); i++ ) {
-		data = ptrace(PTRACE_PEEKTEXT, pid, (void*)sp, NULL);
-		DLOG("checking value 0x%08lx at stack position 0x%08lx\n", data, sp);
-		if (is_ARM_return_address(pid, milist, data)) {
-			DLOG("at sp=%08lx: possible return address 0x%08lx on stack\n",
-				sp, data);
-
-			addr = data-4;
-			data = ptrace(PTRACE_PEEKTEXT, pid, (void*)addr, NULL);
-
-			/* determine function called by branch */
-			func_addr = branch_target(addr, data);
-			DLOG("called function is: 0x%08lx\n", func_addr);
-			exec_addr = addr;
-			DLOG("execution offset in function is: %08lx + 0x%x\n", func_addr,
-				exec_addr-func_addr);
-
-			frame_no++;
-
-			/* FIXTHIS - use pc_to_mapinfo() to find the section name */
-
-			LOG("#%d:0x%08lx in function 0x%08lx at offset 0x%lx\n",
-				frame_no, exec_addr, func_addr, exec_addr-func_addr);
-		}
-		sp += 4;
-	}
+	return scan_stack(mr, milist, sp, NULL, frame_no);
+}
 
-	return frame_no;
+/* guess_unwind_continue()
+ * Carry on a backtrace that another unwinder gave up on, by scanning the
+ * stack from sp up, and adding what is found to frames.
+ * returns number of frames added
+ */
+int guess_unwind_continue(memreader *mr, maptable *milist, frametable *frames,
+	unsigned int sp)
+{
+	flush_code_cache();
+	return scan_stack(mr, milist, sp, frames, 0);
 }
-	
@@ -0,0 +1,208 @@
+/*
+ * mcternan-client.c - memory client for the McTernan unwinder
+ *
+ * Copyright 2011,2012 Sony Network Entertainment
+ *
+ * The McTernan unwinder (in mcternan-unwinder/) finds return addresses by
+ * interpreting the code from the pc onwards until each function returns,
+ * so it needs neither unwind tables nor symbols.  It reads memory a word,
+ * half-word or byte at a time, through callbacks that take no context, so
+ * the reader in use is kept here for the length of an unwind.  Reads from
+ * the stack are served from the stack snapshot, and everything else (the
+ * code, mostly) from a small cache of whole pages, each filled with one
+ * bulk read.  Functions that write to more of the stack than the
+ * unwinder keeps track of by itself get the memory for it from the arena.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <asm/ptrace.h>
+
+#include "utility.h"
+#include "arena.h"
+#include "memreader.h"
+#include "crash_handler.h"
+#include "unwarminder.h"
+
+#ifndef PSR_T_BIT
+#define PSR_T_BIT 0x00000020
+#endif
+
+/* pages of code (or data) kept while unwinding */
+#define CLI_PAGE_SHIFT  12
+#define CLI_PAGE_SIZE   (1 << CLI_PAGE_SHIFT)
+#define CLI_PAGES       16
+
+typedef struct cli_page {
+    unsigned addr;      /* ~0 if unused */
+    unsigned size;      /* bytes that could be read */
+    unsigned char data[CLI_PAGE_SIZE];
+} cli_page;
+
+static cli_page cli_pages[CLI_PAGES];
+static memreader *cli_mr;
+static maptable *cli_map;
+
+static const char *result_name[] = {
+    "success", "too many instructions in a function", "truncated",
+    "inconsistent data", "unsupported instruction", "failure",
+    "illegal instruction", "reset vector reached", "cannot read code",
+    "cannot read code", "cannot read code", "cannot read data",
+    "cannot read data", "cannot read data", "cannot write data",
+};
+
+static void flush_cli_pages(void)
+{
+    int i;
+
+    for (i = 0; i < CLI_PAGES; i++) {
+        cli_pages[i].addr = ~0;
+        cli_pages[i].size = 0;
+    }
+}
+
+/* Copy size bytes at addr.  Returns 1 if they could all be read. */
+static int cli_read(unsigned addr, void *dst, unsigned size)
+{
+    unsigned base = addr & ~(CLI_PAGE_SIZE - 1);
+    cli_page *pg;
+
+    if (addr >= crash_stack.start && addr + size <= crash_stack.end) {
+        return mr_read(cli_mr, addr, dst, size) == size;
+    }
+    /* a read across a page boundary isn't worth caching */
+    if (addr - base + size > CLI_PAGE_SIZE) {
+        return mr_read(cli_mr, addr, dst, size) == size;
+    }
+
+    pg = &cli_pages[(addr >> CLI_PAGE_SHIFT) % CLI_PAGES];
+    if (pg->addr != base) {
+        pg->addr = base;
+        pg->size = mr_read(cli_mr, base, pg->data, CLI_PAGE_SIZE);
+    }
+    if (addr - base + size > pg->size) {
+        return 0;
+    }
+    memcpy(dst, pg->data + (addr - base), size);
+    return 1;
+}
+
+static Boolean cli_read_w(const Int32 a, Int32 *v)
+{
+    return cli_read(a, v, 4) ? TRUE : FALSE;
+}
+
+static Boolean cli_read_h(const Int32 a, Int16 *v)
+{
+    return cli_read(a, v, 2) ? TRUE : FALSE;
+}
+
+static Boolean cli_read_b(const Int32 a, Int8 *v)
+{
+    return cli_read(a, v, 1) ? TRUE : FALSE;
+}
+
+/* Memory to track the writes of functions with large frames in */
+static void *cli_alloc(Int32 size)
+{
+    return arena_alloc(size);
+}
+
+static void cli_release(void *p)
+{
+    arena_free(p);
+}
+
+/* Each return address found becomes a frame; carry on while it fits.
+ * A return to somewhere other than code (0, at the outermost frame) ends
+ * the backtrace.
+ */
+static Boolean cli_report(void *data, Int32 address, Int32 sp)
+{
+    frametable *frames = data;
+    unsigned pc;
+    int added;
+
+    if (!addr_in_code(cli_map, address & ~1)) {
+        return FALSE;
+    }
+    pc = return_to_call_site(cli_mr, address);
+    added = frametable_add(frames, pc, sp, FRAME_EMULATED);
+    if (added == 0) {
+        return TRUE;
+    }
+    frames->stop = added > 0 ? FRAMES_LOOP : FRAMES_LIMIT;
+    frames->stop_pc = pc;
+    frames->stop_sp = sp;
+    return FALSE;
+}
+
+static const UnwindCallbacks cli_callbacks = {
+    cli_report,
+    cli_read_w,
+    cli_read_h,
+    cli_read_b,
+    cli_alloc,
+    cli_release
+#if defined(UNW_DEBUG)
+   ,printf
+#endif
+};
+
+/* Unwind by interpreting the code, and print what was found.
+ * Return the level of stack it unwinds.
+ */
+int mcternan_unwind_backtrace(memreader *mr, maptable *map, int limit)
+{
+    frametable frames;
+    struct pt_regs r;
+    Int32 regs[16];
+    UnwResult res;
+    int i;
+
+    if (mr_get_regs(mr, &r)) {
+        return 0;
+    }
+    for (i = 0; i < 16; i++) {
+        regs[i] = r.uregs[i];
+    }
+    if (r.ARM_cpsr & PSR_T_BIT) {
+        regs[15] |= 1;
+    }
+
+    memset(&frames, 0, sizeof(frames));
+    frames.limit = limit;
+    cli_mr = mr;
+    cli_map = map;
+    flush_cli_pages();
+    /* what it remembers of functions only holds for this process */
+    UnwindMemoReset();
+
+    frametable_add(&frames, r.ARM_pc & ~1, r.ARM_sp, FRAME_EMULATED);
+    res = UnwindStartRegs(regs, &cli_callbacks, &frames);
+    DLOG("McTernan unwinder result %d\n", res);
+
+    /* a truncated unwind has its reason in frames.stop already */
+    dump_backtrace(map, &frames);
+    if (res != UNWIND_SUCCESS && res != UNWIND_TRUNCATED &&
+        res < sizeof(result_name) / sizeof(result_name[0])) {
+        LOG("Unwinding stopped: %s\n", result_name[res]);
+    }
+
+    cli_mr = NULL;
+    cli_map = NULL;
+    i = frames.count;
+    frametable_clear(&frames);
+    return i;
+}
@@ -28,7 +28,7 @@
  * Prototypes
  ***************************************************************************/
 
-static Boolean CliReport(void *data, Int32 address);
+static Boolean CliReport(void *data, Int32 address, Int32 sp);
 static Boolean CliReadW(Int32 a, Int32 *v);
 static Boolean CliReadH(Int32 a, Int16 *v);
 static Boolean CliReadB(Int32 a, Int8  *v);
@@ -43,7 +43,9 @@ const UnwindCallbacks cliCallbacks =
         CliReport,
         CliReadW,
         CliReadH,
-        CliReadB
+        CliReadB,
+        NULL,
+        NULL
 #if defined(UNW_DEBUG)
        ,printf
 #endif
@@ -70,7 +72,7 @@ const UnwindCallbacks cliCallbacks =
  *                 set).
  *
  ***************************************************************************/
-static Boolean CliReport(void *data, Int32 address)
+static Boolean CliReport(void *data, Int32 address, Int32 sp)
 {
     CliStack *s = (CliStack *)data;
 
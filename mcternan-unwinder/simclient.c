@@ -43,7 +43,7 @@
  * Prototypes
  ***************************************************************************/
 
-Boolean CliReport(void *data, Int32 address);
+Boolean CliReport(void *data, Int32 address, Int32 sp);
 Boolean CliReadW(Int32 a, Int32 *v);
 Boolean CliReadH(Int32 a, Int16 *v);
 Boolean CliReadB(Int32 a, Int8  *v);
@@ -65,7 +65,9 @@ const UnwindCallbacks cliCallbacks =
         CliReport,
         CliReadW,
         CliReadH,
-        CliReadB
+        CliReadB,
+        NULL,
+        NULL
 #if defined(UNW_DEBUG)
        ,printf
 #endif
@@ -181,7 +183,7 @@ void SimClientInit()
  *                 set).
  *
  ***************************************************************************/
-Boolean CliReport(void *data, Int32 address)
+Boolean CliReport(void *data, Int32 address, Int32 sp)
 {
     CliStack *s = (CliStack *)data;
 
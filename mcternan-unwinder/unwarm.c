@@ -39,6 +39,11 @@
  * Variables
  **************************************************************************/
 
+/** Functions interpreted so far, hashed by the address interpreting
+ * started at.
+ */
+static UnwMemoEntry memoTable[UNW_MEMO_SIZE];
+
 
 /***************************************************************************
  * Macros
@@ -49,6 +54,207 @@
  * Local Functions
  **************************************************************************/
 
+/** Index into the memo table for some address.
+ */
+static Int16 memoHash(Int32 pc)
+{
+    return ((pc >> 1) ^ (pc >> 9)) & (UNW_MEMO_SIZE - 1);
+}
+
+
+/** Get a bit mask of the valid registers, r0 to r14.
+ */
+static Int16 validMask(const RegData *regFile)
+{
+    Int16 mask = 0;
+    Int8  t;
+
+    for(t = 0; t < 15; t++)
+    {
+        if(M_IsOriginValid(regFile[t].o))
+        {
+            mask |= 1 << t;
+        }
+    }
+
+    return mask;
+}
+
+
+/** Work out the instruction budget for the next function.
+ */
+static void setFrameBudget(UnwState * const state)
+{
+    state->instrLeft -= state->frameInstr;
+    state->frameInstr = 0;
+
+    if(state->instrLeft <= 0)
+    {
+        state->frameLimit = 0;
+    }
+    else if(state->instrLeft / 4 > UNW_MAX_INSTR_COUNT)
+    {
+        state->frameLimit = state->instrLeft / 4;
+    }
+    else
+    {
+        state->frameLimit = UNW_MAX_INSTR_COUNT;
+    }
+}
+
+
+/** Start recording the function about to be interpreted.
+ */
+static void memoBegin(UnwState * const state)
+{
+    UnwMemoRecord * const rec = &state->memo;
+
+    rec->ok       = TRUE;
+    rec->pc       = state->regData[15].v;
+    rec->loaded   = 0;
+    rec->writeTop = 0;
+    memcpy(rec->regData, state->regData, sizeof(rec->regData));
+}
+
+
+/** Put the function just returned from into the memo, if its effect
+ * can be described relative to the SP it started with.
+ */
+static void memoStore(UnwState * const state)
+{
+    const UnwMemoRecord * const rec = &state->memo;
+    const Int32 sp0 = rec->regData[13].v;
+    UnwMemoEntry e;
+    Int8         t;
+
+    if(!rec->ok)
+    {
+        return;
+    }
+
+    e.pc        = rec->pc;
+    e.validIn   = validMask(rec->regData);
+    e.keep      = 0;
+    e.fromStack = 0;
+    e.spAdjust  = state->regData[13].v - sp0;
+    e.retOffset = rec->retAddr - sp0;
+
+    /* The return address has to come from the frame that was popped, and
+     *  nothing may have been written that outlives it.
+     */
+    if(e.spAdjust <= 0 ||
+       rec->retAddr - sp0 >= (Int32)e.spAdjust ||
+       rec->writeTop > state->regData[13].v)
+    {
+        return;
+    }
+
+    for(t = 0; t < 15; t++)
+    {
+        const RegData * const now = &state->regData[t];
+        const RegData * const was = &rec->regData[t];
+
+        if(t == 13 || !M_IsOriginValid(now->o))
+        {
+            continue;
+        }
+
+        if(now->v == was->v && now->o == was->o)
+        {
+            e.keep |= 1 << t;
+        }
+        else if(now->o == REG_VAL_FROM_STACK &&
+                (rec->loaded & (1 << t)) &&
+                rec->loadVal[t] == now->v &&
+                rec->loadAddr[t] - sp0 < (Int32)e.spAdjust)
+        {
+            e.fromStack |= 1 << t;
+            e.offset[t]  = rec->loadAddr[t] - sp0;
+        }
+        else
+        {
+            /* Some value the memo can't describe */
+            return;
+        }
+    }
+
+    UnwPrintd4("Memo: store pc=0x%08x sp%+d ret@%d\n",
+               e.pc, e.spAdjust, e.retOffset);
+
+    memoTable[memoHash(e.pc)] = e;
+}
+
+
+/** Unwind a function from its memo entry.
+ * \return TRUE if unwinding should carry on, otherwise FALSE with the
+ *          reason in *result.
+ */
+static Boolean memoReplay(UnwState * const           state,
+                          const UnwMemoEntry * const e,
+                          UnwResult * const          result)
+{
+    const Int32 sp0 = state->regData[13].v;
+    RegData     ret;
+    Int8        t;
+
+    UnwPrintd3("Memo: replay pc=0x%08x sp=0x%08x\n", e->pc, sp0);
+
+    if(!UnwMemReadRegister(state, sp0 + e->retOffset, &ret))
+    {
+        *result = UNWIND_DREAD_W_FAIL;
+        return FALSE;
+    }
+    if(!M_IsOriginValid(ret.o))
+    {
+        UnwPrintd1("PC popped with invalid address\n");
+        *result = UNWIND_FAILURE;
+        return FALSE;
+    }
+
+    for(t = 0; t < 15; t++)
+    {
+        if(t == 13 || (e->keep & (1 << t)))
+        {
+            continue;
+        }
+
+        if(e->fromStack & (1 << t))
+        {
+            if(!UnwMemReadRegister(state, sp0 + e->offset[t], &state->regData[t]))
+            {
+                *result = UNWIND_DREAD_W_FAIL;
+                return FALSE;
+            }
+            if(M_IsOriginValid(state->regData[t].o))
+            {
+                state->regData[t].o = REG_VAL_FROM_STACK;
+            }
+        }
+        else
+        {
+            state->regData[t].o = REG_VAL_INVALID;
+        }
+    }
+
+    state->regData[13].v += e->spAdjust;
+    state->regData[15].v  = ret.v;
+    state->regData[15].o  = REG_VAL_FROM_STACK;
+    UnwMemHashGC(state);
+
+    if(!UnwReportRetAddr(state, ret.v))
+    {
+        *result = UNWIND_TRUNCATED;
+        return FALSE;
+    }
+    if(ret.v == 0)
+    {
+        *result = UNWIND_RESET;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 
 /***************************************************************************
  * Global Functions
@@ -107,7 +313,24 @@ void UnwInitState(UnwState * const       state,   /**< Pointer to structure to f
     UnwPrintd3("\nInitial: PC=0x%08x SP=0x%08x\n", pcValue, spValue);
 
     /* Invalidate all memory addresses */
-    memset(state->memData.used, 0, sizeof(state->memData.used));
+    UnwMemHashInit(&state->memData, cb);
+
+    /* Set the instruction budget of the first function */
+    state->instrLeft  = UNW_MAX_INSTR_TOTAL;
+    state->frameInstr = 0;
+    setFrameBudget(state);
+
+    /* The first function starts part way through, so isn't remembered */
+    state->frameStart = FALSE;
+    state->memo.ok    = FALSE;
+}
+
+
+/** Forget all remembered functions.
+ */
+void UnwindMemoReset(void)
+{
+    memset(memoTable, 0, sizeof(memoTable));
 }
 
 
@@ -117,10 +340,34 @@ void UnwInitState(UnwState * const       state,   /**< Pointer to structure to f
  */
 Boolean UnwReportRetAddr(UnwState * const state, Int32 addr)
 {
+    UnwMemoRecord * const rec = &state->memo;
+    SignedInt8            t;
+
+    /* Find where the return address was loaded from */
+    if(rec->ok)
+    {
+        rec->ok = FALSE;
+        for(t = 15; t >= 0; t--)
+        {
+            if((rec->loaded & (1 << t)) && rec->loadVal[t] == addr &&
+               state->regData[t].v == addr)
+            {
+                rec->retAddr = rec->loadAddr[t];
+                rec->ok = TRUE;
+                break;
+            }
+        }
+    }
+
+    /* The next function gets a new budget */
+    setFrameBudget(state);
+    state->frameStart = TRUE;
+
     /* Cast away const from reportData.
      *  The const is only to prevent the unw module modifying the data.
      */
-    return state->cb->report((void *)state->reportData, addr);
+    return state->cb->report((void *)state->reportData, addr,
+                             state->regData[13].v);
 }
 
 
@@ -136,6 +383,11 @@ Boolean UnwMemWriteRegister(UnwState * const      state,
                             const Int32           addr,
                             const RegData * const reg)
 {
+    if(addr + 4 > state->memo.writeTop)
+    {
+        state->memo.writeTop = addr + 4;
+    }
+
     return UnwMemHashWrite(&state->memData,
                            addr,
                            reg->v,
@@ -160,18 +412,36 @@ Boolean UnwMemReadRegister(UnwState * const      state,
                            const Int32           addr,
                            RegData * const       reg)
 {
-    Boolean tracked;
+    UnwMemoRecord * const rec = &state->memo;
+    const Boolean         inFile = (reg >= state->regData &&
+                                    reg < state->regData + 16) ? TRUE : FALSE;
+    const Int32           t   = inFile ? reg - state->regData : 0;
+    Boolean               tracked;
 
     /* Check if the value can be found in the hash */
     if(UnwMemHashRead(&state->memData, addr, &reg->v, &tracked))
     {
         reg->o = tracked ? REG_VAL_FROM_MEMORY : REG_VAL_INVALID;
+
+        /* Written while unwinding, so no use to the memo */
+        if(inFile)
+        {
+            rec->loaded &= ~(1 << t);
+        }
         return TRUE;
     }
     /* Not in the hash, so read from real memory */
     else if(state->cb->readW(addr, &reg->v))
     {
         reg->o = REG_VAL_FROM_MEMORY;
+
+        /* Note where registers were loaded from for the memo */
+        if(inFile)
+        {
+            rec->loaded     |= 1 << t;
+            rec->loadAddr[t] = addr;
+            rec->loadVal[t]  = reg->v;
+        }
         return TRUE;
     }
     /* Not in the hash, and failed to read from memory */
@@ -181,6 +451,62 @@ Boolean UnwMemReadRegister(UnwState * const      state,
     }
 }
 
+/** Count an instruction against the budget of the current function.
+ * \return FALSE if the budget has been used up.
+ */
+Boolean UnwCountInstr(UnwState * const state)
+{
+    state->frameInstr++;
+
+    return state->frameInstr < state->frameLimit ? TRUE : FALSE;
+}
+
+
+/** Called as interpreting of a function returned to starts.
+ * The function just returned from is remembered if it can be, and then
+ * as many functions as are found in the memo are unwound from it.
+ * \param state  [in/out] The unwinding state.
+ * \param result [out] Why unwinding finished, if it did.
+ * \return TRUE if interpreting should carry on at the (possibly new) PC,
+ *         otherwise FALSE with the result of the unwind in *result.
+ */
+Boolean UnwFrameStart(UnwState * const state, UnwResult * const result)
+{
+    const Int32 mode = state->regData[15].v & 0x1;
+    const UnwMemoEntry *e;
+
+    state->frameStart = FALSE;
+    memoStore(state);
+    state->memo.ok = FALSE;
+
+    for(;;)
+    {
+        e = &memoTable[memoHash(state->regData[15].v)];
+        if(e->pc != state->regData[15].v ||
+           e->validIn != validMask(state->regData))
+        {
+            break;
+        }
+
+        if(!memoReplay(state, e, result))
+        {
+            return FALSE;
+        }
+        state->frameStart = FALSE;
+    }
+
+    memoBegin(state);
+
+    /* The memo may have returned to the other instruction set */
+    if((state->regData[15].v & 0x1) != mode)
+    {
+        *result = mode ? UnwStartArm(state) : UnwStartThumb(state);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 #endif /* UPGRADE_ARM_STACK_UNWIND */
 
 /* END OF FILE */
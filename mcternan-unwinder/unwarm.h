@@ -26,18 +26,40 @@
  * Manifest Constants
  **************************************************************************/
 
-/** The maximum number of instructions to interpet in a function.
+/** The least number of instructions to interpet in a function.
  * Unwinding will be unconditionally stopped and UNWIND_EXHAUSTED returned
- * if more than this number of instructions are interpreted in a single
- * function without unwinding a stack frame.  This prevents infinite loops
- * or corrupted program memory from preventing unwinding from progressing.
+ * if a function uses up its budget of instructions without unwinding a
+ * stack frame.  Each function may use a quarter of what is left of
+ * UNW_MAX_INSTR_TOTAL, but no fewer than this, so that big functions can
+ * still be unwound while infinite loops or corrupted program memory can't
+ * prevent unwinding from progressing.
  */
 #define UNW_MAX_INSTR_COUNT 100
 
-/** The size of the hash used to track reads and writes to memory.
- * This should be a prime value for efficiency.
+/** The most instructions to interpret over a whole unwind.
+ * Once they are used up, the next function stops unwinding.  A quarter
+ * of this (4096) goes to the first function, which is entered at the
+ * crash and so may be anywhere in a big function, rather than near its
+ * return like the callers after it.
  */
-#define MEM_HASH_SIZE        31
+#define UNW_MAX_INSTR_TOTAL 16384
+
+/** The number of functions remembered in the memo.
+ * This must be a power of 2.
+ */
+#define UNW_MEMO_SIZE       256
+
+/** The size of the hash used to track reads and writes to memory, as it
+ * starts.  This is kept in the unwind state; the hash only needs memory
+ * from the client's alloc callback once a function with a large frame
+ * fills it.  This must be a power of 2.
+ */
+#define MEM_HASH_SIZE        32
+
+/** The most entries the memory hash grows to.
+ * This must be a power of 2.
+ */
+#define MEM_HASH_MAX         65536
 
 /***************************************************************************
  * Type Definitions
@@ -71,33 +93,128 @@ typedef struct
 RegData;
 
 
-/** Structure used to track reads and writes to memory.
- * This structure is used as a hash to store a small number of writes
- * to memory.
+/** One memory location tracked by the hash.
  */
 typedef struct
 {
-    /** Memory contents. */
-    Int32              v[MEM_HASH_SIZE];
+    /** Address which the entry represents. */
+    Int32              a;
 
-    /** Address at which v[n] represents. */
-    Int32              a[MEM_HASH_SIZE];
+    /** Memory contents. */
+    Int32              v;
 
-    /** Indicates whether the data in v[n] and a[n] is occupied.
-     * Each bit represents one hash value.
-     */
-    Int8               used[(MEM_HASH_SIZE + 7) / 8];
+    /** Indicates whether the entry is occupied. */
+    Boolean            used;
 
-    /** Indicates whether the data in v[n] is valid.
-     * This allows a[n] to be set, but for v[n] to be marked as invalid.
+    /** Indicates whether the data in v is valid.
+     * This allows a to be set, but for v to be marked as invalid.
      * Specifically this is needed for when an untracked register value
      * is written to memory.
      */
-    Int8               tracked[(MEM_HASH_SIZE + 7) / 8];
+    Boolean            tracked;
+}
+MemEntry;
+
+
+/** Structure used to track reads and writes to memory.
+ * This is an open addressing hash, which doubles in size whenever it
+ * gets half full.
+ */
+typedef struct
+{
+    /** The entries, either inl or a table from the alloc callback. */
+    MemEntry          *e;
+
+    /** The number of entries less one; the number is a power of 2. */
+    Int32              mask;
+
+    /** How far the hash of an address is shifted to give an index. */
+    Int8               shift;
+
+    /** The number of entries that are occupied. */
+    Int32              count;
+
+    /** The lowest address stored, or lower.
+     * This lets the garbage collector see that there is nothing to free
+     * without searching.
+     */
+    Int32              minAddr;
+
+    /** Set if every address stored is word aligned.
+     * The garbage collector can then free what is below the stack pointer
+     * a word at a time, rather than by searching the whole hash.
+     */
+    Boolean            aligned;
+
+    /** The callbacks used to get and give back memory. */
+    const UnwindCallbacks *cb;
+
+    /** The entries the hash starts with. */
+    MemEntry           inl[MEM_HASH_SIZE];
 }
 MemData;
 
 
+/** What interpreting a function from some address to its return did.
+ * A function that is met again at the same address, with the same
+ * registers valid, is unwound from this instead of being interpreted
+ * again.  Only functions whose effect is fixed relative to the SP are
+ * remembered.
+ */
+typedef struct
+{
+    /** Address interpreting started at, with the Thumb bit.
+     * 0 if the entry is unused.
+     */
+    Int32              pc;
+
+    /** Registers valid at the start, one bit per register. */
+    Int16              validIn;
+
+    /** Registers left as they were. */
+    Int16              keep;
+
+    /** Registers reloaded from the stack, from offset[n]. */
+    Int16              fromStack;
+
+    /** Change to the SP from the start to the return. */
+    SignedInt32        spAdjust;
+
+    /** Where the return address is, from the SP at the start. */
+    SignedInt32        retOffset;
+
+    /** Where each fromStack register is, from the SP at the start. */
+    SignedInt32        offset[15];
+}
+UnwMemoEntry;
+
+
+/** Recording of the function being interpreted, for the memo. */
+typedef struct
+{
+    /** TRUE while the function can still be remembered. */
+    Boolean            ok;
+
+    /** The PC and registers as interpreting started. */
+    Int32              pc;
+    RegData            regData[16];
+
+    /** Registers last loaded straight from memory (not from the hash),
+     * with the address and value loaded.
+     */
+    Int16              loaded;
+    Int32              loadAddr[16];
+    Int32              loadVal[16];
+
+    /** Where the return address was loaded from. */
+    Int32              retAddr;
+
+    /** Highest address written to, plus 4. */
+    Int32              writeTop;
+}
+UnwMemoRecord;
+
+
 /** Structure that is used to keep track of unwinding meta-data.
  * This data is passed between all the unwinding functions.
  */
@@ -114,6 +231,21 @@ typedef struct
 
     /** Pointer to pass to the report function. */
     const void *reportData;
+
+    /** Instructions left for the rest of the unwind. */
+    SignedInt32 instrLeft;
+
+    /** Instructions interpreted in the current function, and its budget. */
+    Int32 frameInstr;
+    Int32 frameLimit;
+
+    /** Set when a return address has been reported, until interpreting
+     * the function returned to starts.
+     */
+    Boolean frameStart;
+
+    /** The current function, as far as the memo is concerned. */
+    UnwMemoRecord memo;
 }
 UnwState;
 
@@ -162,6 +294,11 @@ void UnwInitState           (UnwState * const       state,
 
 Boolean UnwReportRetAddr    (UnwState * const state, Int32 addr);
 
+Boolean UnwCountInstr       (UnwState * const state);
+
+Boolean UnwFrameStart       (UnwState * const state,
+                             UnwResult * const result);
+
 Boolean UnwMemWriteRegister (UnwState * const      state,
                              const Int32           addr,
                              const RegData * const reg);
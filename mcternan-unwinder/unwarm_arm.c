@@ -86,12 +86,22 @@ static Boolean isDataProc(Int32 instr)
 UnwResult UnwStartArm(UnwState * const state)
 {
     Boolean found = FALSE;
-    Int16   t = UNW_MAX_INSTR_COUNT;
 
     do
     {
         Int32 instr;
 
+        /* A function has been returned to */
+        if(state->frameStart)
+        {
+            UnwResult result;
+
+            if(!UnwFrameStart(state, &result))
+            {
+                return result;
+            }
+        }
+
         /* Attempt to read the instruction */
         if(!state->cb->readW(state->regData[15].v, &instr))
         {
@@ -436,6 +446,13 @@ UnwResult UnwStartArm(UnwState * const state)
                     break;
             }
 
+            /* An SP worked out from other registers can't be memoised */
+            if(rd == 13 && (opcode < 8 || opcode > 11) &&
+               !(I && rn == 13 && (opcode == 2 || opcode == 4)))
+            {
+                state->memo.ok = FALSE;
+            }
+
             /* Account for pre-fetch by temporarily adjusting PC */
             if(rn == 15)
             {
@@ -612,7 +629,7 @@ UnwResult UnwStartArm(UnwState * const state)
                     {
                         if(addrValid)
                         {
-                            if(!UnwMemWriteRegister(state, state->regData[13].v, &state->regData[r]))
+                            if(!UnwMemWriteRegister(state, addr, &state->regData[r]))
                             {
                                 return UNWIND_DWRITE_W_FAIL;
                             }
@@ -632,6 +649,12 @@ UnwResult UnwStartArm(UnwState * const state)
             /* Check the writeback bit */
             if(W) state->regData[baseReg].v = addr;
 
+            /* An SP loaded from memory can't be memoised */
+            if(L && (regList & (0x01 << 13)))
+            {
+                state->memo.ok = FALSE;
+            }
+
             /* Check if the PC was loaded */
             if(L && (regList & (0x01 << 15)))
             {
@@ -686,8 +709,7 @@ UnwResult UnwStartArm(UnwState * const state)
         /* Garbage collect the memory hash (used only for the stack) */
         UnwMemHashGC(state);
 
-        t--;
-        if(t == 0) return UNWIND_EXHAUSTED;
+        if(!UnwCountInstr(state)) return UNWIND_EXHAUSTED;
 
     }
     while(!found);
@@ -71,12 +71,22 @@ static SignedInt16 signExtend11(Int16 value)
 UnwResult UnwStartThumb(UnwState * const state)
 {
     Boolean  found = FALSE;
-    Int16    t = UNW_MAX_INSTR_COUNT;
 
     do
     {
         Int16 instr;
 
+        /* A function has been returned to */
+        if(state->frameStart)
+        {
+            UnwResult result;
+
+            if(!UnwFrameStart(state, &result))
+            {
+                return result;
+            }
+        }
+
         /* Attempt to read the instruction */
         if(!state->cb->readH(state->regData[15].v & (~0x1), &instr))
         {
@@ -451,6 +461,12 @@ UnwResult UnwStartThumb(UnwState * const state)
                 return UNWIND_ILLEGAL_INSTR;
             }
 
+            /* An SP worked out from other registers can't be memoised */
+            if(rhd == 13 && (op == 0 || op == 2))
+            {
+                state->memo.ok = FALSE;
+            }
+
             switch(op)
             {
                 case 0: /* ADD */
@@ -469,8 +485,8 @@ UnwResult UnwStartThumb(UnwState * const state)
                 case 2: /* MOV */
                     UnwPrintd5("MOV r%d, r%d\t; r%d %s",
                                rhd, rhs, rhd, M_Origin2Str(state->regData[rhs].o));
-                    state->regData[rhd].v += state->regData[rhs].v;
-                    state->regData[rhd].o  = state->regData[rhd].o;
+                    state->regData[rhd].v = state->regData[rhs].v;
+                    state->regData[rhd].o = state->regData[rhs].o;
                     break;
 
                 case 3: /* BX */
@@ -725,8 +741,7 @@ UnwResult UnwStartThumb(UnwState * const state)
         /* Garbage collect the memory hash (used only for the stack) */
         UnwMemHashGC(state);
 
-        t--;
-        if(t == 0) return UNWIND_EXHAUSTED;
+        if(!UnwCountInstr(state)) return UNWIND_EXHAUSTED;
 
     }
     while(!found);
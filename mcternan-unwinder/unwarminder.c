@@ -23,6 +23,7 @@
 #include <string.h>
 #include "unwarminder.h"
 #include "unwarm.h"
+#include "unwarmmem.h"
 
 
 /***************************************************************************
@@ -58,14 +59,17 @@ UnwResult UnwindStart(Int32                  spValue,
                       const UnwindCallbacks *cb,
                       void                  *data)
 {
-    Int32    retAddr;
-    UnwState state;
+    Int32     retAddr;
+    UnwState  state;
+    UnwResult result;
 
-#if !defined(SIM_CLIENT)
-    retAddr = __return_address();
-#else
+#if defined(SIM_CLIENT)
     retAddr = 0x0000a894;
     spValue = 0x7ff7edf8;
+#elif defined(__GNUC__)
+    retAddr = (Int32)__builtin_return_address(0);
+#else
+    retAddr = __return_address();
 #endif
 
     /* Initialise the unwinding state */
@@ -74,12 +78,56 @@ UnwResult UnwindStart(Int32                  spValue,
     /* Check the Thumb bit */
     if(retAddr & 0x1)
     {
-        return UnwStartThumb(&state);
+        result = UnwStartThumb(&state);
+    }
+    else
+    {
+        result = UnwStartArm(&state);
+    }
+
+    UnwMemHashFree(&state.memData);
+    return result;
+}
+
+UnwResult UnwindStartRegs(const Int32            regs[16],
+                          const UnwindCallbacks *cb,
+                          void                  *data)
+{
+    UnwState  state;
+    UnwResult result;
+    Int8      t;
+
+    /* Initialise the unwinding state */
+    UnwInitState(&state, cb, data, regs[15], regs[13]);
+
+    /* The other registers are known too, and an epilogue that restores
+     *  sp from a frame pointer needs them.
+     */
+    for(t = 0; t < 13; t++)
+    {
+        state.regData[t].v = regs[t];
+        state.regData[t].o = REG_VAL_FROM_CONST;
+    }
+
+    /* A function that has not pushed its return address yet returns
+     *  through the link register, so that counts as a return address
+     *  from the stack.
+     */
+    state.regData[14].v = regs[14];
+    state.regData[14].o = REG_VAL_FROM_STACK;
+
+    /* Check the Thumb bit */
+    if(regs[15] & 0x1)
+    {
+        result = UnwStartThumb(&state);
     }
     else
     {
-        return UnwStartArm(&state);
+        result = UnwStartArm(&state);
     }
+
+    UnwMemHashFree(&state.memData);
+    return result;
 }
 
 #endif /* UPGRADE_ARM_STACK_UNWIND */
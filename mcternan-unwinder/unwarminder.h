@@ -43,7 +43,7 @@ typedef enum UnwResultTag
     /** Unwinding was successful and complete. */
     UNWIND_SUCCESS = 0,
 
-    /** More than UNW_MAX_INSTR_COUNT instructions were interpreted. */
+    /** A function used up its budget of instructions. */
     UNWIND_EXHAUSTED,
 
     /** Unwinding stopped because the reporting func returned FALSE. */
@@ -88,11 +88,12 @@ typedef enum UnwResultTag
 UnwResult;
 
 /** Type for function pointer for result callback.
- * The function is passed two parameters, the first is a void * pointer,
+ * The function is passed three parameters, the first is a void * pointer,
  * and the second is the return address of the function.  The bottom bit
  * of the passed address indicates the execution mode; if it is set,
  * the execution mode at the return address is Thumb, otherwise it is
- * ARM.
+ * ARM.  The third is the stack pointer as the function returns, which
+ * tells apart the frames of a recursive function.
  *
  * The return value of this function determines whether unwinding should
  * continue or not.  If TRUE is returned, unwinding will continue and the
@@ -100,7 +101,8 @@ UnwResult;
  * unwinding will stop with UnwindStart() returning UNWIND_TRUNCATED.
  */
 typedef Boolean (*UnwindReportFunc)(void   *data,
-                                    Int32   address);
+                                    Int32   address,
+                                    Int32   sp);
 
 /** Structure that holds memory callback function pointers.
  */
@@ -131,6 +133,18 @@ typedef struct UnwindCallbacksTag
      */
     Boolean (*readB)(const Int32 address, Int8  *val);
 
+    /** Allocate memory for the unwinder's own use.
+     * This is only called once a function writes to more of the stack
+     * than the unwinder can track by itself, and should return NULL if
+     * there is no memory.  Everything allocated is passed back to
+     * release before UnwindStart() returns.  Both may be NULL, in which
+     * case unwinding through such a function fails.
+     */
+    void   *(*alloc)(Int32 size);
+
+    /** Release memory from alloc. */
+    void    (*release)(void *p);
+
 #if defined(UNW_DEBUG)
     /** Print a formatted line for debug. */
     int (*printf)(const char *format, ...);
@@ -156,6 +170,25 @@ UnwResult UnwindStart(Int32                  spValue,
                       const UnwindCallbacks *cb,
                       void                  *data);
 
+/** Start unwinding a stack other than the current one.
+ * This is for a stack whose registers were saved somewhere, such as that
+ * of a stopped process.  Unwinding starts at regs[15], which has the
+ * bottom bit set for Thumb, with the stack pointer in regs[13].  The link
+ * register regs[14] is taken as the return address of the function at
+ * regs[15], if it returns through it.  r0-r12 start out with their saved
+ * values, for epilogues that restore sp from a frame pointer.
+ */
+UnwResult UnwindStartRegs(const Int32            regs[16],
+                          const UnwindCallbacks *cb,
+                          void                  *data);
+
+/** Forget the functions remembered from earlier unwinds.
+ * The memo of functions is kept from one unwind to the next, which is
+ * only right for as long as the code at each address stays the same;
+ * it has to be reset before unwinding a different program.
+ */
+void UnwindMemoReset(void);
+
 #endif /* UPGRADE_ARM_STACK_UNWIND */
 
 #endif /* UNWARMINDER_H */
@@ -20,6 +20,7 @@
 #include <system.h>
 #if defined(UPGRADE_ARM_STACK_UNWIND)
 #include <stdio.h>
+#include <string.h>
 #include "unwarmmem.h"
 #include "unwarm.h"
 
@@ -27,6 +28,10 @@
  * Manifest Constants
  **************************************************************************/
 
+/** Multiplier for the hash; the top bits of the product spread
+ * neighbouring stack words over the whole table.
+ */
+#define MEM_HASH_MUL 0x9e3779b1U
 
 /***************************************************************************
  * Type Definitions
@@ -43,73 +48,167 @@
  **************************************************************************/
 
 
-#define M_IsIdxUsed(a, v) (((a)[v >> 3] & (1 << (v & 0x7))) ? TRUE : FALSE)
-
-#define M_SetIdxUsed(a, v) ((a)[v >> 3] |= (1 << (v & 0x7)))
-
-#define M_ClrIdxUsed(a, v) ((a)[v >> 3] &= ~(1 << (v & 0x7)))
-
 /***************************************************************************
  * Local Functions
  **************************************************************************/
 
+/** Get the slot at which the search for an address starts.
+ */
+static Int32 memHashSlot(const MemData * const memData,
+                         const Int32           addr)
+{
+    return ((addr >> 2) * MEM_HASH_MUL) >> memData->shift;
+}
+
+
 /** Search the memory hash to see if an entry is stored in the hash already.
  * This will search the hash and either return the index where the item is
- * stored, or -1 if the item was not found.
+ * stored, or the free index where it should be stored.  The hash always
+ * has a free entry, so the search ends.
  */
-static SignedInt16 memHashIndex(MemData * const memData,
-                                const Int32     addr)
+static Int32 memHashIndex(const MemData * const memData,
+                          const Int32           addr)
 {
-    const Int16 v = addr % MEM_HASH_SIZE;
-    Int16       s = v;
+    Int32 s = memHashSlot(memData, addr);
 
-    do
+    while(memData->e[s].used && memData->e[s].a != addr)
     {
-        /* Check if the element is occupied */
-        if(M_IsIdxUsed(memData->used, s))
+        s = (s + 1) & memData->mask;
+    }
+
+    return s;
+}
+
+
+/** Double the size of the hash.
+ * Returns FALSE if it is as big as it gets, or no memory could be had,
+ * in which case the hash is left as it was.
+ */
+static Boolean memHashGrow(MemData * const memData)
+{
+    const Int32     oldSize = memData->mask + 1;
+    MemEntry * const old    = memData->e;
+    MemEntry       *e;
+    Int32           t;
+
+    if(oldSize >= MEM_HASH_MAX || memData->cb->alloc == NULL)
+    {
+        return FALSE;
+    }
+
+    e = memData->cb->alloc(oldSize * 2 * sizeof(MemEntry));
+    if(e == NULL)
+    {
+        return FALSE;
+    }
+    memset(e, 0, oldSize * 2 * sizeof(MemEntry));
+
+#if defined(UNW_DEBUG)
+    memData->cb->printf("MemHashGrow: %d entries\n", oldSize * 2);
+#endif
+
+    memData->e     = e;
+    memData->mask  = oldSize * 2 - 1;
+    memData->shift--;
+
+    for(t = 0; t < oldSize; t++)
+    {
+        if(old[t].used)
         {
-            /* Check if it is occupied with the sought data */
-            if(memData->a[s] == addr)
-            {
-                return s;
-            }
+            e[memHashIndex(memData, old[t].a)] = old[t];
         }
-        else
+    }
+
+    if(old != memData->inl && memData->cb->release != NULL)
+    {
+        memData->cb->release(old);
+    }
+
+    return TRUE;
+}
+
+
+/** Remove the entry at index hole from the hash.
+ * Entries after it that were displaced past the hole are moved back into
+ * it, so that no search ever has to step over a deleted entry.
+ */
+static void memHashDelete(MemData * const memData,
+                          Int32           hole)
+{
+    MemEntry * const e = memData->e;
+    Int32            s = hole;
+    Int32            home;
+
+    for(;;)
+    {
+        s = (s + 1) & memData->mask;
+        if(!e[s].used)
         {
-            /* Item is free, this is where the item should be stored */
-            return s;
+            break;
         }
 
-        /* Search the next entry */
-        s++;
-        if(s > MEM_HASH_SIZE)
+        /* The entry can move back if the hole is between its home and s */
+        home = memHashSlot(memData, e[s].a);
+        if(((s - home) & memData->mask) >= ((s - hole) & memData->mask))
         {
-            s = 0;
+            e[hole] = e[s];
+            hole    = s;
         }
     }
-    while(s != v);
 
-    /* Search failed, hash is full and the address not stored */
-    return -1;
+    e[hole].used = FALSE;
+    memData->count--;
 }
 
 
-
 /***************************************************************************
  * Global Functions
  **************************************************************************/
 
+void UnwMemHashInit(MemData * const              memData,
+                    const UnwindCallbacks * const cb)
+{
+    Int32 n;
+
+    memData->cb      = cb;
+    memData->e       = memData->inl;
+    memData->mask    = MEM_HASH_SIZE - 1;
+    memData->count   = 0;
+    memData->minAddr = 0xffffffff;
+    memData->aligned = TRUE;
+
+    memData->shift = 32;
+    for(n = MEM_HASH_SIZE; n > 1; n >>= 1)
+    {
+        memData->shift--;
+    }
+
+    memset(memData->inl, 0, sizeof(memData->inl));
+}
+
+
+void UnwMemHashFree(MemData * const memData)
+{
+    if(memData->e != memData->inl && memData->cb->release != NULL)
+    {
+        memData->cb->release(memData->e);
+    }
+
+    memData->e = memData->inl;
+}
+
+
 Boolean UnwMemHashRead(MemData * const memData,
                        Int32           addr,
                        Int32   * const data,
                        Boolean * const tracked)
 {
-    SignedInt16 i = memHashIndex(memData, addr);
+    const MemEntry * const e = &memData->e[memHashIndex(memData, addr)];
 
-    if(i >= 0 && M_IsIdxUsed(memData->used, i) && memData->a[i] == addr)
+    if(e->used)
     {
-        *data    = memData->v[i];
-        *tracked = M_IsIdxUsed(memData->tracked, i);
+        *data    = e->v;
+        *tracked = e->tracked;
         return TRUE;
     }
     else
@@ -124,34 +223,53 @@ Boolean UnwMemHashWrite(MemData * const memData,
                         Int32           val,
                         Boolean         valValid)
 {
-    SignedInt16 i = memHashIndex(memData, addr);
+    Int32     i = memHashIndex(memData, addr);
+    MemEntry *e;
 
-    if(i < 0)
+    if(!memData->e[i].used)
     {
-        /* Hash full */
-        return FALSE;
-    }
-    else
-    {
-        /* Store the item */
-        memData->a[i] = addr;
-        M_SetIdxUsed(memData->used, i);
+        /* Keep the hash at most half full, so that searches stay short */
+        if(memData->count >= (memData->mask + 1) / 2 && memHashGrow(memData))
+        {
+            i = memHashIndex(memData, addr);
+        }
+
+        if(memData->count >= memData->mask)
+        {
+            /* Hash full */
+            return FALSE;
+        }
+
+        memData->e[i].used = TRUE;
+        memData->e[i].a    = addr;
+        memData->count++;
 
-        if(valValid)
+        if(addr < memData->minAddr)
         {
-            memData->v[i] = val;
-            M_SetIdxUsed(memData->tracked, i);
+            memData->minAddr = addr;
         }
-        else
+        if(addr & 0x3)
         {
-#if defined(UNW_DEBUG)
-            memData->v[i] = 0xdeadbeef;
-#endif
-            M_ClrIdxUsed(memData->tracked, i);
+            memData->aligned = FALSE;
         }
+    }
 
-        return TRUE;
+    /* Store the item */
+    e = &memData->e[i];
+    if(valValid)
+    {
+        e->v       = val;
+        e->tracked = TRUE;
+    }
+    else
+    {
+#if defined(UNW_DEBUG)
+        e->v       = 0xdeadbeef;
+#endif
+        e->tracked = FALSE;
     }
+
+    return TRUE;
 }
 
 
@@ -159,18 +277,54 @@ void UnwMemHashGC(UnwState * const state)
 {
     const Int32 minValidAddr = state->regData[13].v;
     MemData * const memData  = &state->memData;
-    Int16       t;
+    Int32       minAddr      = 0xffffffff;
+    Int32       a, t;
+
+    /* Mostly there is nothing below the stack pointer to free */
+    if(memData->count == 0 || memData->minAddr >= minValidAddr)
+    {
+        return;
+    }
+
+    /* Free the words up to the stack pointer, if there are fewer of them
+     *  than entries in the hash.
+     */
+    if(memData->aligned && (memData->minAddr & 0x3) == 0 &&
+       (minValidAddr - memData->minAddr) / 4 <= memData->mask)
+    {
+        for(a = memData->minAddr; a < minValidAddr; a += 4)
+        {
+            t = memHashIndex(memData, a);
+            if(memData->e[t].used)
+            {
+                UnwPrintd3("MemHashGC: Free elem %d, addr 0x%08x\n", t, a);
+
+                memHashDelete(memData, t);
+            }
+        }
 
-    for(t = 0; t < MEM_HASH_SIZE; t++)
+        memData->minAddr = (minValidAddr + 3) & ~0x3;
+        return;
+    }
+
+    for(t = 0; t <= memData->mask; t++)
     {
-        if(M_IsIdxUsed(memData->used, t) && (memData->a[t] < minValidAddr))
+        /* Deleting moves a later entry into this slot, so check again */
+        while(memData->e[t].used && memData->e[t].a < minValidAddr)
         {
             UnwPrintd3("MemHashGC: Free elem %d, addr 0x%08x\n",
-                       t, memData->a[t]);
+                       t, memData->e[t].a);
+
+            memHashDelete(memData, t);
+        }
 
-            M_ClrIdxUsed(memData->used, t);
+        if(memData->e[t].used && memData->e[t].a < minAddr)
+        {
+            minAddr = memData->e[t].a;
         }
     }
+
+    memData->minAddr = minAddr;
 }
 
 #endif /* UPGRADE_ARM_STACK_UNWIND */
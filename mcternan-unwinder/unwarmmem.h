@@ -41,6 +41,11 @@
  *  Function Prototypes
  **************************************************************************/
 
+void    UnwMemHashInit  (MemData * const               memData,
+                         const UnwindCallbacks * const cb);
+
+void    UnwMemHashFree  (MemData * const memData);
+
 Boolean UnwMemHashRead  (MemData * const memData,
                          Int32           addr,
                          Int32   * const data,
@@ -0,0 +1,315 @@
+/*
+ * memreader.c - live and snapshot memory readers for the crash handler
+ *
+ * Copyright 2011,2012 Sony Network Entertainment
+ *
+ * The unwinders and the report code used to call ptrace directly, so
+ * they could only be used against a live, stopped process.  They now go
+ * through a memreader (see memreader.h), so the same code can run over a
+ * snapshot of the process or over a core file.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <sys/ptrace.h>
+
+#include "memreader.h"
+#include "arena.h"
+#include "crash_handler.h"
+
+/* number of separate blocks a snapshot reader can hold */
+#define MAX_SNAPSHOT_REGIONS	16
+
+/* live reads bigger than this skip the page cache and go straight to
+ * one bulk read, so that big one-shot copies (like the stack snapshot)
+ * don't get chopped up into pages and then copied twice.
+ */
+#define LIVE_UNCACHED_READ	(4*4096)
+
+/****************************************
+ * generic reader routines
+ ****************************************/
+
+size_t mr_read(memreader *mr, unsigned addr, void *dst, size_t size)
+{
+    size_t done = 0;
+
+    while (mr && done < size) {
+        done += mr->read(mr, addr+done, dst+done, size-done);
+        mr = mr->next;
+    }
+    return done;
+}
+
+int mr_read_word(memreader *mr, unsigned addr)
+{
+    int val;
+
+    if (mr_read(mr, addr, &val, sizeof(val)) != sizeof(val)) {
+        return -1;
+    }
+    return val;
+}
+
+void mr_read_struct(memreader *mr, unsigned addr, void *dst, size_t size)
+{
+    size_t done;
+
+    done = mr_read(mr, addr, dst, size);
+    if (done < size) {
+        memset(dst+done, 0xff, size-done);
+    }
+}
+
+int mr_get_regs(memreader *mr, struct pt_regs *regs)
+{
+    for (; mr; mr = mr->next) {
+        if (mr->get_regs && mr->get_regs(mr, regs) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int mr_get_region(memreader *mr, unsigned addr, unsigned *start,
+                  unsigned *end)
+{
+    for (; mr; mr = mr->next) {
+        if (mr->get_region && mr->get_region(mr, addr, start, end)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void mr_close(memreader *mr)
+{
+    memreader *next;
+
+    while (mr) {
+        next = mr->next;
+        mr->close(mr);
+        mr = next;
+    }
+}
+
+/****************************************
+ * live reader
+ ****************************************/
+
+typedef struct live_reader {
+    memreader mr;
+    pid_t pid;
+    maptable *map;
+} live_reader;
+
+static size_t live_read(memreader *mr, unsigned addr, void *dst, size_t size)
+{
+    live_reader *lr = (live_reader *)mr;
+
+    if (size > LIVE_UNCACHED_READ) {
+        return get_remote_block(lr->pid, (void *)addr, dst, size);
+    }
+    return get_remote_cached(lr->pid, (void *)addr, dst, size);
+}
+
+static int live_get_regs(memreader *mr, struct pt_regs *regs)
+{
+    live_reader *lr = (live_reader *)mr;
+
+    return ptrace(PTRACE_GETREGS, lr->pid, 0, regs);
+}
+
+static int live_get_region(memreader *mr, unsigned addr, unsigned *start,
+                           unsigned *end)
+{
+    live_reader *lr = (live_reader *)mr;
+
+    return find_maps_region(lr->map, addr, start, end);
+}
+
+static void live_close(memreader *mr)
+{
+    flush_remote_cache();
+    arena_free(mr);
+}
+
+memreader *open_live_reader(pid_t pid, maptable *map)
+{
+    live_reader *lr;
+
+    lr = arena_calloc(1, sizeof(live_reader));
+    if (!lr) {
+        return NULL;
+    }
+    lr->mr.read = live_read;
+    lr->mr.get_regs = live_get_regs;
+    lr->mr.get_region = live_get_region;
+    lr->mr.close = live_close;
+    lr->pid = pid;
+    lr->map = map;
+
+    return &lr->mr;
+}
+
+/****************************************
+ * snapshot reader
+ ****************************************/
+
+typedef struct snapshot_region {
+    unsigned start;
+    unsigned end;
+    unsigned char *data;
+} snapshot_region;
+
+typedef struct snapshot_reader {
+    memreader mr;
+    int have_regs;
+    struct pt_regs regs;
+    int count;
+    snapshot_region region[MAX_SNAPSHOT_REGIONS];
+} snapshot_reader;
+
+static size_t snapshot_read(memreader *mr, unsigned addr, void *dst,
+                            size_t size)
+{
+    snapshot_reader *sr = (snapshot_reader *)mr;
+    snapshot_region *rg;
+    size_t done = 0;
+    size_t chunk;
+    int i;
+
+    /* regions may abut, so keep going until nothing covers addr */
+    i = 0;
+    while (done < size && i < sr->count) {
+        rg = &sr->region[i];
+        if (addr >= rg->start && addr < rg->end) {
+            chunk = rg->end - addr;
+            if (chunk > size - done) {
+                chunk = size - done;
+            }
+            memcpy(dst+done, rg->data + (addr - rg->start), chunk);
+            done += chunk;
+            addr += chunk;
+            i = 0;
+            continue;
+        }
+        i++;
+    }
+    return done;
+}
+
+static int snapshot_get_regs(memreader *mr, struct pt_regs *regs)
+{
+    snapshot_reader *sr = (snapshot_reader *)mr;
+
+    if (!sr->have_regs) {
+        return -1;
+    }
+    memcpy(regs, &sr->regs, sizeof(*regs));
+    return 0;
+}
+
+static int snapshot_get_region(memreader *mr, unsigned addr,
+                               unsigned *start, unsigned *end)
+{
+    snapshot_reader *sr = (snapshot_reader *)mr;
+    int i;
+
+    for (i = 0; i < sr->count; i++) {
+        if (addr >= sr->region[i].start && addr < sr->region[i].end) {
+            *start = sr->region[i].start;
+            *end = sr->region[i].end;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void snapshot_close(memreader *mr)
+{
+    snapshot_reader *sr = (snapshot_reader *)mr;
+    int i;
+
+    for (i = 0; i < sr->count; i++) {
+        arena_free(sr->region[i].data);
+    }
+    arena_free(sr);
+}
+
+memreader *open_snapshot_reader(memreader *next)
+{
+    snapshot_reader *sr;
+
+    /* without one, reads just go to next */
+    sr = arena_calloc(1, sizeof(snapshot_reader));
+    if (!sr) {
+        return next;
+    }
+    sr->mr.read = snapshot_read;
+    sr->mr.get_regs = snapshot_get_regs;
+    sr->mr.get_region = snapshot_get_region;
+    sr->mr.close = snapshot_close;
+    sr->mr.next = next;
+
+    /* registers don't change while we look at them, so fetch them once */
+    if (next && mr_get_regs(next, &sr->regs) == 0) {
+        sr->have_regs = 1;
+    }
+
+    return &sr->mr;
+}
+
+int is_snapshot_reader(const memreader *mr)
+{
+    return mr && mr->read == snapshot_read;
+}
+
+int snapshot_add_region(memreader *mr, unsigned start, void *data,
+                        size_t size)
+{
+    snapshot_reader *sr = (snapshot_reader *)mr;
+    snapshot_region *rg;
+
+    if (sr->count >= MAX_SNAPSHOT_REGIONS) {
+        return -1;
+    }
+    rg = &sr->region[sr->count++];
+    rg->start = start;
+    rg->end = start + size;
+    rg->data = data;
+
+    return 0;
+}
+
+size_t snapshot_capture(memreader *mr, unsigned start, unsigned end)
+{
+    void *data;
+    size_t size;
+
+    if (end <= start || !mr->next) {
+        return 0;
+    }
+
+    data = arena_alloc(end - start);
+    if (!data) {
+        return 0;
+    }
+    size = mr_read(mr->next, start, data, end - start) & ~3;
+    if (size == 0 || snapshot_add_region(mr, start, data, size) < 0) {
+        arena_free(data);
+        return 0;
+    }
+    return size;
+}
@@ -0,0 +1,129 @@
+/* memreader.h - interchangeable sources of crashed-process memory
+**
+** Copyright 2011,2012 Sony Network Entertainment
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef __memreader_h
+#define __memreader_h
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <asm/ptrace.h>
+
+#include "utility.h" /* needed for mapinfo */
+
+/*
+ * A memreader is where the unwinders and the report code get the memory
+ * and registers of the crashed process from.  There are four kinds:
+ *  - live: a stopped tracee, read through the remote page cache
+ *  - snapshot: blocks of memory already copied into this process
+ *  - elf: unwind tables, read from the ELF files behind the maps
+ *  - core: an ELF core file
+ * Readers can be stacked with 'next', so that a snapshot of the stack can
+ * sit in front of the live process, for example.
+ */
+typedef struct memreader memreader;
+
+struct memreader {
+    /* Copy size bytes at addr into dst.  Returns the number of bytes
+     * copied before the first one this reader can't supply.
+     */
+    size_t (*read)(memreader *mr, unsigned addr, void *dst, size_t size);
+
+    /* Get the registers of the crashed thread.  Returns 0 on success. */
+    int (*get_regs)(memreader *mr, struct pt_regs *regs);
+
+    /* Find the mapping that contains addr.  Returns 1 if there is one. */
+    int (*get_region)(memreader *mr, unsigned addr, unsigned *start,
+                      unsigned *end);
+
+    /* Release the reader and anything it holds */
+    void (*close)(memreader *mr);
+
+    /* Reader to ask for whatever this one doesn't have, or NULL */
+    memreader *next;
+};
+
+/* Read a block through mr (and the readers behind it).  Returns the
+ * number of bytes read before the first unreadable one.
+ */
+extern size_t mr_read(memreader *mr, unsigned addr, void *dst, size_t size);
+
+/* Get a word through mr.  As with PTRACE_PEEKTEXT, an unreadable address
+ * gives -1.
+ */
+extern int mr_read_word(memreader *mr, unsigned addr);
+
+/* Read a structure through mr.  Unreadable bytes are set to 0xff. */
+extern void mr_read_struct(memreader *mr, unsigned addr, void *dst,
+                           size_t size);
+
+extern int mr_get_regs(memreader *mr, struct pt_regs *regs);
+extern int mr_get_region(memreader *mr, unsigned addr, unsigned *start,
+                         unsigned *end);
+
+/* Close mr and every reader stacked behind it */
+extern void mr_close(memreader *mr);
+
+/* A stopped, ptrace-attached process, with its maps already read into
+ * map (from which its regions are found)
+ */
+extern memreader *open_live_reader(pid_t pid, maptable *map);
+
+/* Memory already in this process.  The registers are taken from next
+ * (if any) when the reader is opened.  If there's no memory for it, next
+ * is returned instead.
+ */
+extern memreader *open_snapshot_reader(memreader *next);
+
+/* Is mr a snapshot reader (that blocks can be added to)? */
+extern int is_snapshot_reader(const memreader *mr);
+
+/* Add a block at remote address start to a snapshot reader.  The reader
+ * takes ownership of data, which must have come from arena_alloc().
+ */
+extern int snapshot_add_region(memreader *mr, unsigned start, void *data,
+                               size_t size);
+
+/* Copy [start, end) from the readers behind a snapshot reader into the
+ * snapshot, with a single bulk read.  Returns the number of bytes captured.
+ */
+extern size_t snapshot_capture(memreader *mr, unsigned start, unsigned end);
+
+/* The unwind tables (.ARM.exidx and .ARM.extab) of the objects in map,
+ * read from local copies instead of from the process, where there are
+ * any.  Everything else is passed on to next.
+ */
+extern memreader *open_elf_reader(maptable *map, memreader *next);
+
+/* Map the ELF file behind mi read-only, into mi->obj->image.  The file is
+ * found through /proc/<pid>/map_files if possible, so that deleted or
+ * replaced files still work.  Returns 0 on success.
+ */
+extern int map_elf_file(maptable *mt, mapinfo *mi);
+
+/* Once an object's headers are known, point its tables at the copies in
+ * its mapped file, checking through mr that the file is the right one.
+ * Returns 0 on success.
+ */
+extern int use_elf_file_tables(memreader *mr, elfobj *obj);
+
+/* An ELF core file, as written by the kernel */
+extern memreader *open_core_reader(const char *path);
+
+/* Build the executable map table of a core file from its NT_FILE note */
+extern maptable *get_core_mapinfo_list(memreader *mr);
+
+#endif
@@ -0,0 +1,856 @@
+/*
+ * report-render.c - the parts of a crash report, as text, JSON or records
+ *
+ * Copyright 2011,2012 Sony Network Entertainment
+ *
+ * crash_handler reads the registers, code, stack and maps of the crashed
+ * process, and hands them to the write_* calls here to go into the
+ * report.  In a text or JSON report they are formatted straight away.
+ * In a binary one they are saved as records, and render_report() does
+ * the same formatting from those later, on the device or on a host.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "utility.h"
+#include "arena.h"
+#include "report-render.h"
+#include "crash_handler.h"
+
+/* longest run of frames that dump_backtrace() folds when it repeats */
+#define MAX_REPEAT_PERIOD 8
+
+/*
+ * render_memory_maps - write the maps text kept by parse_maps_text() into
+ * the report, in a single write.  Each line is indented by a space (which
+ * crash_syms relies on), and executable maps of objects with a GNU
+ * build-id get it added at the end of the line:
+ *  b6f00000-b6f3e000 r-xp 00000000 b3:01 1638   /system/lib/libc.so build_id=3f0c...
+ */
+static void render_memory_maps(maptable *milist)
+{
+    char *out, *p, *line, *end;
+    unsigned start;
+    mapinfo *mi;
+    int len, lines, i;
+
+    if (!milist || !milist->text || report_fd < 0) {
+        return;
+    }
+    end = milist->text + milist->text_size;
+    for (lines = 1, line = milist->text; line < end; line++) {
+        lines += (*line == 0);
+    }
+    out = arena_alloc(milist->text_size + lines * 2 +
+                      milist->count * (sizeof(" build_id=") + MAX_BUILD_ID*2));
+    if (!out) {
+        return;
+    }
+
+    p = out;
+    for (line = milist->text; line < end; line += len + 1) {
+        len = strlen(line);
+        *p++ = ' ';
+        memcpy(p, line, len);
+        p += len;
+
+        start = strtoul(line, 0, 16);
+        mi = find_mapinfo(milist, start);
+        if (mi && mi->start == start && mi->obj && mi->obj->build_id_len &&
+            mi->name >= line && mi->name <= line + len) {
+            memcpy(p, " build_id=", 10);
+            p += 10;
+            for (i = 0; i < mi->obj->build_id_len; i++) {
+                p = fmt_hex8(p, mi->obj->build_id[i]);
+            }
+        }
+        *p++ = '\n';
+    }
+    report_write(report_fd, out, p - out);
+    arena_free(out);
+}
+
+/* the length of the maps field at p */
+static int maps_field_len(const char *p)
+{
+    const char *q = p;
+
+    while (*q && *q != ' ') q++;
+    return q - p;
+}
+
+/*
+ * json_memory_maps - the maps as one JSON object, with the fields of
+ * each line split out:
+ *  {"section":"memory maps","maps":[{"start":3069181952,"end":...,
+ *   "perms":"r-xp","offset":0,"dev":"b3:01","inode":1638,
+ *   "name":"/system/lib/libc.so","build_id":"3f0c..."},...]}
+ */
+static void json_memory_maps(maptable *milist)
+{
+    char *line, *p, *end;
+    char hex[MAX_BUILD_ID*2];
+    unsigned start;
+    mapinfo *mi;
+    int i;
+
+    if (!milist || !milist->text || report_fd < 0) {
+        return;
+    }
+    json_begin(report_fd);
+    json_key("maps");
+    json_open('[');
+    end = milist->text + milist->text_size;
+    for (line = milist->text; line < end; line += strlen(line) + 1) {
+        p = line;
+        while (*p == ' ') p++;
+        if (!*p) {
+            continue;
+        }
+        json_open('{');
+        start = strtoul(p, &p, 16);
+        json_key("start");
+        json_uint(start);
+        json_key("end");
+        json_uint(strtoul(*p == '-' ? p + 1 : p, 0, 16));
+        p = next_maps_field(p);
+        json_key("perms");
+        json_string(p, maps_field_len(p));
+        p = next_maps_field(p);
+        json_key("offset");
+        json_uint(strtoul(p, 0, 16));
+        p = next_maps_field(p);
+        json_key("dev");
+        json_string(p, maps_field_len(p));
+        p = next_maps_field(p);
+        json_key("inode");
+        json_uint(strtoul(p, 0, 10));
+        p = next_maps_field(p);
+        json_key("name");
+        json_string(p, strlen(p));
+
+        mi = find_mapinfo(milist, start);
+        if (mi && mi->start == start && mi->obj && mi->obj->build_id_len &&
+            mi->name >= line && mi->name <= p + strlen(p)) {
+            for (i = 0; i < mi->obj->build_id_len; i++) {
+                fmt_hex8(hex + i*2, mi->obj->build_id[i]);
+            }
+            json_key("build_id");
+            json_string(hex, mi->obj->build_id_len * 2);
+        }
+        json_close('}');
+    }
+    json_close(']');
+    json_end();
+}
+
+/*
+ * write_memory_maps - the maps, as text, JSON or a REC_MAPS record.  The
+ * record holds the size of the maps text, the text (with its lines
+ * ended by NULs), and then the start of each map that has a build-id,
+ * the length of the build-id and the build-id itself.  Each part is
+ * padded to 4 bytes.
+ */
+void write_memory_maps(maptable *milist)
+{
+    unsigned *rec, *p;
+    mapinfo *mi;
+    int i;
+
+    if (report_json) {
+        json_memory_maps(milist);
+        return;
+    }
+    if (!report_binary) {
+        render_memory_maps(milist);
+        return;
+    }
+    if (!milist || !milist->text || report_fd < 0) {
+        return;
+    }
+    rec = arena_alloc(4 + REC_PAD(milist->text_size) +
+                      milist->count * (8 + REC_PAD(MAX_BUILD_ID)));
+    if (!rec) {
+        return;
+    }
+
+    rec[0] = milist->text_size;
+    memset((char *)(rec + 1) + milist->text_size, 0,
+           REC_PAD(milist->text_size) - milist->text_size);
+    memcpy(rec + 1, milist->text, milist->text_size);
+    p = rec + 1 + REC_PAD(milist->text_size) / 4;
+    for (i = 0; i < milist->count; i++) {
+        mi = &milist->map[i];
+        if (mi->obj && mi->obj->build_id_len) {
+            *p++ = mi->start;
+            *p++ = mi->obj->build_id_len;
+            p[REC_PAD(mi->obj->build_id_len) / 4 - 1] = 0;
+            memcpy(p, mi->obj->build_id, mi->obj->build_id_len);
+            p += REC_PAD(mi->obj->build_id_len) / 4;
+        }
+    }
+    report_record(report_fd, REC_MAPS, rec, (char *)p - (char *)rec);
+    arena_free(rec);
+}
+
+static void render_registers(const unsigned *regs, maptable *map)
+{
+    static const char *names[16] = {
+        "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
+        "r8", "r9", "10", "fp", "ip", "sp", "lr", "pc"
+    };
+    int i;
+
+    report_section(report_fd, "registers");
+    LOG(" r0 %08x  r1 %08x  r2 %08x  r3 %08x\n",
+         regs[0], regs[1], regs[2], regs[3]);
+    LOG(" r4 %08x  r5 %08x  r6 %08x  r7 %08x\n",
+         regs[4], regs[5], regs[6], regs[7]);
+    LOG(" r8 %08x  r9 %08x  10 %08x  fp %08x\n",
+         regs[8], regs[9], regs[10], regs[11]);
+    LOG(" ip %08x  sp %08x  lr %08x  pc %08x  cpsr %08x\n",
+         regs[12], regs[13], regs[14], regs[15], regs[16]);
+
+    /* name the file behind any register that points into code */
+    for (i = 0; i < 16; i++) {
+        if (addr_in_code(map, regs[i])) {
+            LOG(" %s %08x  %s\n", names[i], regs[i],
+                 map_to_name(map, regs[i], ""));
+        }
+    }
+    LOG("\n");
+}
+
+/* the registers as one JSON object, by name */
+static void json_registers(const unsigned *regs)
+{
+    static const char *names[NUM_REPORT_REGS] = {
+        "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
+        "r8", "r9", "r10", "fp", "ip", "sp", "lr", "pc", "cpsr"
+    };
+    int i;
+
+    if (report_fd < 0) {
+        return;
+    }
+    report_section(report_fd, "registers");
+    json_begin(report_fd);
+    for (i = 0; i < NUM_REPORT_REGS; i++) {
+        json_key(names[i]);
+        json_uint(regs[i]);
+    }
+    json_end();
+}
+
+void write_registers(const unsigned *regs, maptable *map)
+{
+    if (report_binary) {
+        report_record(report_fd, REC_REGS, regs,
+                      NUM_REPORT_REGS * sizeof(*regs));
+    } else if (report_json) {
+        json_registers(regs);
+    } else {
+        render_registers(regs, map);
+    }
+}
+
+static void render_pc_code(unsigned pc, const unsigned *code)
+{
+    unsigned start, end, i;
+    unsigned val;
+    char *out;
+
+    report_section(report_fd, "code around PC");
+    start = pc - PC_CODE_WORDS*2;
+    end = pc + PC_CODE_WORDS*2;
+    for(i = start; i<end; i += 4) {
+	val = code[(i-start)/4];
+	/* "0x%08lx: %08lx" and the marker, without printf */
+	out = report_reserve(report_fd, 32);
+	*out++ = '0';
+	*out++ = 'x';
+	out = fmt_hex32(out, i);
+	*out++ = ':';
+	*out++ = ' ';
+	out = fmt_hex32(out, val);
+	if (i==pc) {
+	    memcpy(out, " <-- PC", 7);
+	    out += 7;
+	}
+	*out++ = '\n';
+	report_commit(out);
+    }
+}
+
+/* the pc, where the code shown starts, and the code, as JSON */
+static void json_pc_code(unsigned pc, const unsigned *code)
+{
+    int i;
+
+    if (report_fd < 0) {
+        return;
+    }
+    report_section(report_fd, "code around PC");
+    json_begin(report_fd);
+    json_key("pc");
+    json_uint(pc);
+    json_key("start");
+    json_uint(pc - PC_CODE_WORDS*2);
+    json_key("code");
+    json_open('[');
+    for (i = 0; i < PC_CODE_WORDS; i++) {
+        json_uint(code[i]);
+    }
+    json_close(']');
+    json_end();
+}
+
+/* a REC_PC_CODE record is the pc and then the code */
+void write_pc_code(unsigned pc, const unsigned *code)
+{
+    unsigned rec[1 + PC_CODE_WORDS];
+
+    if (report_binary) {
+        rec[0] = pc;
+        memcpy(rec + 1, code, PC_CODE_WORDS*4);
+        report_record(report_fd, REC_PC_CODE, rec, sizeof(rec));
+    } else if (report_json) {
+        json_pc_code(pc, code);
+    } else {
+        render_pc_code(pc, code);
+    }
+}
+
+/*
+ * Print a backtrace, and why the unwinder stopped if it didn't reach the
+ * end.  Recursion shows up as the same few frames over and over, so a run
+ * of frames that repeats the block just before it (at least twice) is
+ * printed as one line instead.  Frames found by scanning the stack rather
+ * than from unwind tables are marked "(guess)", and those from the frame
+ * pointer chain "(fp)".
+ */
+static void render_backtrace(maptable *map, const frametable *frames)
+{
+    const frameinfo *f = frames->frame;
+    const mapinfo *mi;
+    unsigned rel_pc;
+    int i, n, p, end, last;
+
+    for (i = 0; i < frames->count; ) {
+        for (p = 1; p <= MAX_REPEAT_PERIOD && i + 3*p <= frames->count; p++) {
+            for (end = i + p; end < frames->count &&
+                 f[end].pc == f[end - p].pc; end++) {
+            }
+            if (end - i >= 3*p) {
+                break;
+            }
+        }
+        if (p > MAX_REPEAT_PERIOD || i + 3*p > frames->count) {
+            p = 0;
+        }
+
+        /* the frame itself, or the first copy of the repeated block */
+        for (n = i; n < i + (p ? p : 1); n++) {
+            /* offsets in shared libraries are relative to the library,
+             * since a library may be loaded anywhere
+             */
+            rel_pc = f[n].pc;
+            mi = pc_to_mapinfo(map, f[n].pc, &rel_pc);
+            LOG("         #%02d  pc %08x  %s%s\n", n, rel_pc,
+                 mi ? mi->name : "",
+                 f[n].method == FRAME_GUESS ? "  (guess)" :
+                 f[n].method == FRAME_FP ? "  (fp)" : "");
+        }
+        if (!p) {
+            i++;
+            continue;
+        }
+        last = i + (end - i) / p * p - 1;
+        LOG("         #%02d..#%02d  repeat #%02d..#%02d %d times\n",
+             i + p, last, i, i + p - 1, (last + 1 - i) / p - 1);
+        i = last + 1;
+    }
+
+    switch (frames->stop) {
+    case FRAMES_NO_TABLE:
+        /* Shed more debugging info for stack unwinder improvement */
+        mi = find_mapinfo(map, frames->stop_pc);
+        if (mi) {
+            LOG("Relative PC=%#x from %s not contained in EXIDX\n",
+                 frames->stop_pc - mi->start, mi->name);
+        }
+        LOG("PC=%#x SP=%#x\n", frames->stop_pc, frames->stop_sp);
+        break;
+    case FRAMES_LOOP:
+        LOG("Unwinding loops at PC=%#x SP=%#x\n", frames->stop_pc,
+             frames->stop_sp);
+        break;
+    case FRAMES_LIMIT:
+        LOG("Backtrace cut off after %d frames\n", frames->count);
+        break;
+    case FRAMES_BAD_LINK:
+        LOG("Frame pointer chain broken at PC=%#x SP=%#x\n",
+             frames->stop_pc, frames->stop_sp);
+        break;
+    }
+}
+
+/* the unwinder the backtraces being written come from */
+static const char *unwinder_name = "";
+
+/* each backtrace is headed "= name unwinder =" in a text report */
+void start_backtrace(const char *name)
+{
+    unwinder_name = name;
+    if (!report_json) {
+        LOG("= %s unwinder =\n", name);
+    }
+}
+
+/*
+ * A backtrace as one JSON object, every frame in full:
+ *  {"section":"call stack","unwinder":"hybrid","frames":[{"pc":1234,
+ *   "sp":5678,"rel_pc":234,"object":"/system/lib/libc.so",
+ *   "method":"table"},...],"stop":"end"}
+ * rel_pc is relative to the library for shared libraries, as in a text
+ * report.  Unless the unwinder reached the end, stop_pc and stop_sp say
+ * where it got to.
+ */
+static void json_backtrace(maptable *map, const frametable *frames)
+{
+    static const char *methods[] = { "table", "guess", "fp", "emulated" };
+    static const char *stops[] = {
+        "end", "no table", "loop", "limit", "bad link"
+    };
+    const frameinfo *f = frames->frame;
+    const mapinfo *mi;
+    unsigned rel_pc;
+    int i;
+
+    if (report_fd < 0) {
+        return;
+    }
+    json_begin(report_fd);
+    json_key("unwinder");
+    json_string(unwinder_name, strlen(unwinder_name));
+    json_key("frames");
+    json_open('[');
+    for (i = 0; i < frames->count; i++) {
+        rel_pc = f[i].pc;
+        mi = pc_to_mapinfo(map, f[i].pc, &rel_pc);
+        json_open('{');
+        json_key("pc");
+        json_uint(f[i].pc);
+        json_key("sp");
+        json_uint(f[i].sp);
+        json_key("rel_pc");
+        json_uint(rel_pc);
+        if (mi) {
+            json_key("object");
+            json_string(mi->name, strlen(mi->name));
+        }
+        if (f[i].method >= 0 && f[i].method <= FRAME_EMULATED) {
+            json_key("method");
+            json_string(methods[f[i].method], strlen(methods[f[i].method]));
+        }
+        json_close('}');
+    }
+    json_close(']');
+    if (frames->stop >= 0 && frames->stop <= FRAMES_BAD_LINK) {
+        json_key("stop");
+        json_string(stops[frames->stop], strlen(stops[frames->stop]));
+    }
+    if (frames->stop != FRAMES_END && frames->stop != FRAMES_LIMIT) {
+        json_key("stop_pc");
+        json_uint(frames->stop_pc);
+        json_key("stop_sp");
+        json_uint(frames->stop_sp);
+    }
+    json_end();
+}
+
+/* a REC_FRAMES record: the number of frames, why the unwinder stopped
+ * and where, and then the pc, sp and method of each frame
+ */
+#define FRAMES_REC_HEADER 4
+
+void dump_backtrace(maptable *map, const frametable *frames)
+{
+    unsigned *rec;
+    size_t size;
+
+    if (report_json) {
+        json_backtrace(map, frames);
+        return;
+    }
+    if (!report_binary) {
+        render_backtrace(map, frames);
+        return;
+    }
+    size = FRAMES_REC_HEADER*4 + frames->count * sizeof(frameinfo);
+    rec = arena_alloc(size);
+    if (!rec) {
+        return;
+    }
+    rec[0] = frames->count;
+    rec[1] = frames->stop;
+    rec[2] = frames->stop_pc;
+    rec[3] = frames->stop_sp;
+    memcpy(rec + FRAMES_REC_HEADER, frames->frame,
+           frames->count * sizeof(frameinfo));
+    report_record(report_fd, REC_FRAMES, rec, size);
+    arena_free(rec);
+}
+
+/* one line of the stack dump, as
+ *  LOG("%s %08x  %08x  %s\n", prompt, addr, data, name)
+ * would print it, but without the printf
+ */
+static void log_stack_word(const char *prompt, unsigned addr, unsigned data,
+                           const char *name)
+{
+    size_t plen = strlen(prompt);
+    size_t nlen = strlen(name);
+    char *out;
+
+    if (report_fd < 0) {
+        return;
+    }
+    if (plen + nlen + 24 > REPORT_LINE_MAX) {
+        LOG("%s %08x  %08x  %s\n", prompt, addr, data, name);
+        return;
+    }
+    out = report_reserve(report_fd, plen + nlen + 24);
+    memcpy(out, prompt, plen);
+    out += plen;
+    *out++ = ' ';
+    out = fmt_hex32(out, addr);
+    *out++ = ' ';
+    *out++ = ' ';
+    out = fmt_hex32(out, data);
+    *out++ = ' ';
+    *out++ = ' ';
+    memcpy(out, name, nlen);
+    out += nlen;
+    *out++ = '\n';
+    report_commit(out);
+}
+
+/* words from start on that are shown */
+static unsigned stackdump_count(const stackdump *sd)
+{
+    return (sd->end >= sd->start ? (sd->end - sd->start) / 4 + 1 : 0) + 17;
+}
+
+static unsigned stackdump_sp(const stackdump *sd, unsigned n)
+{
+    return n < sd->nsp ? sd->sp[n] : 0;
+}
+
+static unsigned stackdump_word(const stackdump *sd, unsigned p)
+{
+    if (sd->words) {
+        return sd->words[(p - sd->start) / 4];
+    }
+    return sd->read_word(sd->mr, p);
+}
+
+static void render_stack_and_code(maptable *map, const stackdump *sd)
+{
+    unsigned int p, end, data;
+    int sp_depth;
+    char *out;
+
+    report_section(report_fd, "code");
+
+    end = p = sd->code_addr + 16;
+    p -= 16;
+
+    /* Dump the code as:
+     *  PC         contents
+     *  00008d34   fffffcd0 4c0eb530 b0934a0e 1c05447c
+     *  00008d44   f7ff18a0 490ced94 68035860 d0012b00
+     */
+    while (p <= end) {
+        int i;
+
+        out = report_reserve(report_fd, 48);
+        *out++ = ' ';
+        out = fmt_hex32(out, p);
+        *out++ = ' ';
+        *out++ = ' ';
+        for (i = 0; i < 4; i++) {
+            *out++ = ' ';
+            out = fmt_hex32(out, sd->code[(p - (end - 16)) / 4]);
+            p += 4;
+        }
+        *out++ = '\n';
+        report_commit(out);
+    }
+    LOG("\n");
+
+    report_section(report_fd, "stack dump");
+
+    /* If the crash is due to PC == 0, there will be two frames that
+     * have identical SP value.
+     */
+    if (stackdump_sp(sd, 0) == stackdump_sp(sd, 1)) {
+        sp_depth = 1;
+    }
+    else {
+        sp_depth = 0;
+    }
+
+    p = sd->start;
+    end = sd->end;
+    while (p <= end) {
+         char *prompt; 
+         char level[16];
+         data = stackdump_word(sd, p);
+         if (p == stackdump_sp(sd, sp_depth)) {
+             sprintf(level, "#%02d", sp_depth++);
+             prompt = level;
+         }
+         else {
+             prompt = "   ";
+         }
+         
+         log_stack_word(prompt, p, data, map_to_name(map, data, ""));
+         p += 4;
+    }
+    /* print another 64-byte of stack data after the last frame */
+
+    end = p+64;
+    while (p <= end) {
+         data = stackdump_word(sd, p);
+         log_stack_word("   ", p, data, map_to_name(map, data, ""));
+         p += 4;
+    }
+
+    LOG("\n");
+}
+
+/*
+ * The [code] and [stack dump] sections as JSON objects.  The words are
+ * written out as they are read; the files they point into can be found
+ * from the maps.
+ *  {"section":"code","start":1234,"words":[...]}
+ *  {"section":"stack dump","start":5678,"words":[...],"frame_sp":[...]}
+ */
+static void json_stack_and_code(const stackdump *sd)
+{
+    unsigned p, i, count;
+
+    if (report_fd < 0) {
+        return;
+    }
+    report_section(report_fd, "code");
+    json_begin(report_fd);
+    json_key("start");
+    json_uint(sd->code_addr);
+    json_key("words");
+    json_open('[');
+    for (i = 0; i < 8; i++) {
+        json_uint(sd->code[i]);
+    }
+    json_close(']');
+    json_end();
+
+    report_section(report_fd, "stack dump");
+    json_begin(report_fd);
+    json_key("start");
+    json_uint(sd->start);
+    json_key("words");
+    json_open('[');
+    count = stackdump_count(sd);
+    for (i = 0, p = sd->start; i < count; i++, p += 4) {
+        json_uint(stackdump_word(sd, p));
+    }
+    json_close(']');
+    json_key("frame_sp");
+    json_open('[');
+    for (i = 0; i < sd->nsp; i++) {
+        json_uint(sd->sp[i]);
+    }
+    json_close(']');
+    json_end();
+}
+
+void write_stack_and_code(maptable *map, const stackdump *sd)
+{
+    unsigned *rec;
+    unsigned p, count;
+
+    if (report_json) {
+        json_stack_and_code(sd);
+        return;
+    }
+
+    /* without the memory to gather the stack in, it goes in as text */
+    count = stackdump_count(sd);
+    rec = report_binary ? arena_alloc(STACKDUMP_REC_SIZE + count*4) : NULL;
+    if (!rec) {
+        render_stack_and_code(map, sd);
+        return;
+    }
+    memcpy(rec, sd, STACKDUMP_REC_SIZE);
+    for (p = 0; p < count; p++) {
+        rec[STACKDUMP_REC_SIZE/4 + p] = stackdump_word(sd, sd->start + p*4);
+    }
+    report_record(report_fd, REC_STACK, rec, STACKDUMP_REC_SIZE + count*4);
+    arena_free(rec);
+}
+
+/*
+ * render_report - write a binary report out as the text report it
+ * stands for.  This only needs the report file, so it can be run on a
+ * host as well as on the device.
+ */
+int render_report(const char *path, int out_fd)
+{
+    maptable *map;
+    frametable frames;
+    stackdump sd;
+    report_rec rec;
+    unsigned char *data, *end, *p;
+    unsigned *w;
+    char *text;
+    mapinfo *mi;
+    int fd, size, n;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return -1;
+    }
+    size = lseek(fd, 0, SEEK_END);
+    data = malloc(size > 0 ? size : 1);
+    if (!data || size <= 0 || pread(fd, data, size, 0) != size) {
+        fprintf(stderr, "Could not read %s\n", path);
+        close(fd);
+        free(data);
+        return -1;
+    }
+    close(fd);
+    end = data + size;
+
+    if (size >= sizeof(rec) + 4) {
+        memcpy(&rec, data, sizeof(rec));
+    }
+    if (size < sizeof(rec) + 4 || rec.type != REC_START ||
+        *(unsigned *)(data + sizeof(rec)) != REPORT_MAGIC) {
+        fprintf(stderr, "%s is not a binary crash report\n", path);
+        free(data);
+        return -1;
+    }
+
+    report_fd = out_fd;
+    report_binary = 0;
+    map = arena_calloc(1, sizeof(maptable));
+
+    for (p = data; p + sizeof(rec) <= end;
+         p += sizeof(rec) + REC_PAD(rec.len)) {
+        memcpy(&rec, p, sizeof(rec));
+        if (rec.len > end - p - sizeof(rec)) {
+            LOG("(report cut short)\n");
+            break;
+        }
+        w = (unsigned *)(p + sizeof(rec));
+
+        switch (rec.type) {
+        case REC_TEXT:
+        case REC_KLOG:
+            report_write(report_fd, w, rec.len);
+            break;
+
+        case REC_MAPS:
+            /* the text, with its lines put back, then the build-ids */
+            if (rec.len < 4 || w[0] > rec.len - 4 || !map ||
+                !(text = arena_alloc(w[0] + 1))) {
+                break;
+            }
+            memcpy(text, w + 1, w[0]);
+            for (n = 0; n < w[0]; n++) {
+                if (text[n] == 0) {
+                    text[n] = '\n';
+                }
+            }
+            parse_maps_text(map, text, w[0], NULL);
+            for (n = 1 + REC_PAD(w[0]) / 4; n + 2 <= rec.len / 4;
+                 n += 2 + REC_PAD(w[n + 1]) / 4) {
+                mi = find_mapinfo(map, w[n]);
+                if (w[n + 1] > MAX_BUILD_ID ||
+                    n*4 + 8 + w[n + 1] > rec.len) {
+                    break;
+                }
+                if (mi && mi->obj) {
+                    mi->obj->build_id_len = w[n + 1];
+                    memcpy(mi->obj->build_id, w + n + 2, w[n + 1]);
+                }
+            }
+            render_memory_maps(map);
+            break;
+
+        case REC_REGS:
+            if (rec.len >= NUM_REPORT_REGS*4) {
+                render_registers(w, map);
+            }
+            break;
+
+        case REC_PC_CODE:
+            if (rec.len >= (1 + PC_CODE_WORDS)*4) {
+                render_pc_code(w[0], w + 1);
+            }
+            break;
+
+        case REC_FRAMES:
+            if (rec.len < FRAMES_REC_HEADER*4 ||
+                w[0] > (rec.len - FRAMES_REC_HEADER*4) / sizeof(frameinfo)) {
+                break;
+            }
+            memset(&frames, 0, sizeof(frames));
+            frames.count = w[0];
+            frames.stop = w[1];
+            frames.stop_pc = w[2];
+            frames.stop_sp = w[3];
+            frames.frame = (frameinfo *)(w + FRAMES_REC_HEADER);
+            render_backtrace(map, &frames);
+            break;
+
+        case REC_STACK:
+            if (rec.len < STACKDUMP_REC_SIZE) {
+                break;
+            }
+            memset(&sd, 0, sizeof(sd));
+            memcpy(&sd, w, STACKDUMP_REC_SIZE);
+            if (sd.nsp > STACK_CONTENT_DEPTH ||
+                stackdump_count(&sd) > (rec.len - STACKDUMP_REC_SIZE) / 4) {
+                break;
+            }
+            sd.words = w + STACKDUMP_REC_SIZE/4;
+            render_stack_and_code(map, &sd);
+            break;
+        }
+    }
+
+    report_flush();
+    free_maptable(map);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,83 @@
+/* report-render.h - the parts of a crash report, as text, JSON or records
+**
+** Copyright 2011,2012 Sony Network Entertainment
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef __report_render_h
+#define __report_render_h
+
+#include <stddef.h>
+
+#include "utility.h" /* needed for maptable */
+#include "report-writer.h"
+
+/*
+ * Each write_* call takes what was read from the crashed process and
+ * adds it to the report at report_fd, in whichever form the report is
+ * in.  None of this touches the process, so it builds on a host too.
+ */
+
+/* the maps text kept by the table, and the build-ids of its objects */
+extern void write_memory_maps(maptable *map);
+
+/* r0-pc and then cpsr, as kept in a REC_REGS record */
+#define NUM_REPORT_REGS 17
+
+extern void write_registers(const unsigned *regs, maptable *map);
+
+/* words of code shown around the pc, half of them before it */
+#define PC_CODE_WORDS 0x20
+
+/* code[] is what is at pc - PC_CODE_WORDS*2 on */
+extern void write_pc_code(unsigned pc, const unsigned *code);
+
+/* head the backtraces that follow with the name of their unwinder */
+extern void start_backtrace(const char *name);
+
+/* print the frames an unwinder found, folding repeated ones */
+extern void dump_backtrace(maptable *map, const frametable *frames);
+
+struct memreader;
+
+/*
+ * What the [code] and [stack dump] sections show: the code at code_addr,
+ * and the stack from start up to end (the sp of the last frame shown)
+ * and 64 bytes past it, with the sp of each frame marked.  The stack is
+ * read from words if that is set, and with read_word from mr otherwise.
+ * A REC_STACK record is the part of this up to words, followed by the
+ * words.
+ */
+typedef struct stackdump {
+    unsigned code_addr;
+    unsigned code[8];
+    unsigned start;
+    unsigned end;
+    unsigned nsp;
+    unsigned sp[STACK_CONTENT_DEPTH];
+    const unsigned *words;
+    struct memreader *mr;
+    int (*read_word)(struct memreader *mr, unsigned addr);
+} stackdump;
+
+#define STACKDUMP_REC_SIZE offsetof(stackdump, words)
+
+extern void write_stack_and_code(maptable *map, const stackdump *sd);
+
+/* Write the binary report in path out to fd as the text report it
+ * stands for.  Returns 0 on success.
+ */
+extern int render_report(const char *path, int fd);
+
+#endif
@@ -0,0 +1,526 @@
+/*
+ * report-writer.c - buffered output for the crash report
+ *
+ * Copyright 2011,2012 Sony Network Entertainment
+ *
+ * A report is thousands of short lines, and a write() for each of them
+ * is slow on flash.  They are collected in one buffer instead, which is
+ * written out when it fills up and at the end of each part of the
+ * report.  Big blocks (the maps, the kernel log) go out with whatever
+ * is in the buffer in a single writev().  If the handler itself faults
+ * part way through, what was collected is still written out before it
+ * dies.
+ *
+ * For a binary report, text is gathered into REC_TEXT records as it is
+ * added, each one closed off when another kind of record comes along or
+ * the buffer is written out.
+ *
+ * A JSON report is a stream of bytes like a text one.  Text is escaped
+ * into the "text" string of an object as it is added, and that object is
+ * closed off when another one is started, a new section begins or the
+ * buffer is written out.  Nothing is put together in memory beyond what
+ * goes into the buffer.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "report-writer.h"
+
+const char report_hex[16] = "0123456789abcdef";
+
+int report_fd = -1;
+int report_binary;
+int report_json;
+
+static char *buf;
+static size_t buf_size;
+static size_t buf_len;      /* bytes waiting to be written */
+static int out_fd = -1;
+
+/* where the REC_TEXT record being added to starts in buf, or -1 */
+static long text_at = -1;
+
+/* where a line goes together when there is no buffer, and whether the
+ * last report_reserve() handed it out
+ */
+static char line[REPORT_LINE_MAX];
+static int reserved_line;
+
+static const char zeros[4];
+
+/* the section JSON objects are for, and whether the last one is still
+ * having text added to it
+ */
+static const char *json_section = "";
+static int json_text_open;
+
+/* JSON nesting: whether a value has been added at each depth yet, and
+ * whether a key is waiting for its value
+ */
+#define JSON_MAX_DEPTH 8
+static unsigned char json_first[JSON_MAX_DEPTH];
+static int json_depth;
+static int json_keyed;
+
+/* Write out iov[0..n), in however many goes it takes */
+static void write_all(struct iovec *iov, int n)
+{
+    ssize_t done;
+
+    while (n > 0) {
+        done = writev(out_fd, iov, n);
+        if (done < 0 && errno == EINTR) {
+            continue;
+        }
+        if (done <= 0) {
+            return;
+        }
+        while (n > 0 && (size_t)done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+}
+
+/* Fill in the header of the text record being added to, and pad it.
+ * There is always room for the padding, as report_reserve() allows for
+ * it.
+ */
+static void close_text(void)
+{
+    report_rec rec;
+
+    if (text_at < 0) {
+        return;
+    }
+    rec.type = REC_TEXT;
+    rec.len = buf_len - text_at - sizeof(rec);
+    if (rec.len == 0) {
+        buf_len = text_at;
+    } else {
+        memcpy(buf + text_at, &rec, sizeof(rec));
+        memset(buf + buf_len, 0, REC_PAD(rec.len) - rec.len);
+        buf_len = text_at + sizeof(rec) + REC_PAD(rec.len);
+    }
+    text_at = -1;
+}
+
+/* Write out the buffer as it is */
+static void write_buffer(void)
+{
+    struct iovec iov;
+
+    if (buf_len && out_fd >= 0) {
+        iov.iov_base = buf;
+        iov.iov_len = buf_len;
+        write_all(&iov, 1);
+    }
+    buf_len = 0;
+}
+
+static void json_close_text(void);
+
+/* Open records and JSON objects are finished off first, so that what is
+ * written out stands on its own.
+ */
+void report_flush(void)
+{
+    json_close_text();
+    close_text();
+    write_buffer();
+}
+
+/* Write out what is buffered and then a block of len bytes (as a record
+ * of type, for a binary report), all in one go.
+ */
+static void write_block(unsigned type, const void *data, size_t len)
+{
+    struct iovec iov[4];
+    report_rec rec;
+    int n = 0;
+
+    close_text();
+    if (buf_len) {
+        iov[n].iov_base = buf;
+        iov[n++].iov_len = buf_len;
+    }
+    if (report_binary) {
+        rec.type = type;
+        rec.len = len;
+        iov[n].iov_base = &rec;
+        iov[n++].iov_len = sizeof(rec);
+    }
+    iov[n].iov_base = (void *)data;
+    iov[n++].iov_len = len;
+    if (report_binary && REC_PAD(len) != len) {
+        iov[n].iov_base = (void *)zeros;
+        iov[n++].iov_len = REC_PAD(len) - len;
+    }
+    if (out_fd >= 0) {
+        write_all(iov, n);
+    }
+    buf_len = 0;
+}
+
+/* What is buffered belongs to the old fd */
+static void use_fd(int fd)
+{
+    if (fd != out_fd) {
+        report_flush();
+        out_fd = fd;
+    }
+}
+
+/* Only writev() is used here, which is safe in a signal handler */
+static void flush_on_fault(int sig)
+{
+    report_flush();
+    raise(sig);
+}
+
+void report_init(char *b, size_t size)
+{
+    static const int faults[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+    struct sigaction sa;
+    int i;
+
+    report_flush();
+    buf = b;
+    buf_size = b ? size : 0;
+
+    /* the handler goes back to the default action once it has run */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = flush_on_fault;
+    sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    for (i = 0; i < sizeof(faults) / sizeof(faults[0]); i++) {
+        sigaction(faults[i], &sa, NULL);
+    }
+}
+
+/* Add n bytes as they are */
+static void put(const char *s, size_t n)
+{
+    size_t room;
+
+    if (buf_size == 0) {
+        write_block(REC_TEXT, s, n);
+        return;
+    }
+    while (n > 0) {
+        if (buf_len == buf_size) {
+            write_buffer();
+        }
+        room = buf_size - buf_len;
+        if (room > n) {
+            room = n;
+        }
+        memcpy(buf + buf_len, s, room);
+        buf_len += room;
+        s += room;
+        n -= room;
+    }
+}
+
+/* Add n bytes as the inside of a JSON string.  Runs of plain characters
+ * go in with one copy.
+ */
+static void put_escaped(const char *s, size_t n)
+{
+    const unsigned char *u = (const unsigned char *)s;
+    char esc[6];
+    size_t run, len;
+
+    while (n > 0) {
+        for (run = 0; run < n && u[run] >= 0x20 && u[run] < 0x7f &&
+             u[run] != '"' && u[run] != '\\'; run++) {
+        }
+        put((const char *)u, run);
+        u += run;
+        n -= run;
+        if (n == 0) {
+            break;
+        }
+        esc[0] = '\\';
+        len = 2;
+        switch (*u) {
+        case '"':
+        case '\\':
+            esc[1] = *u;
+            break;
+        case '\n':
+            esc[1] = 'n';
+            break;
+        case '\t':
+            esc[1] = 't';
+            break;
+        default:
+            memcpy(esc + 1, "u00", 3);
+            fmt_hex8(esc + 4, *u);
+            len = 6;
+            break;
+        }
+        put(esc, len);
+        u++;
+        n--;
+    }
+}
+
+/* A comma before anything but the first value at this depth */
+static void json_sep(void)
+{
+    if (json_keyed) {
+        json_keyed = 0;
+        return;
+    }
+    if (!json_first[json_depth]) {
+        put(",", 1);
+    }
+    json_first[json_depth] = 0;
+}
+
+/* End the object text is being added to, if there is one */
+static void json_close_text(void)
+{
+    if (json_text_open) {
+        json_text_open = 0;
+        put("\"", 1);
+        json_end();
+    }
+}
+
+/* Text goes into an object of its own; blank lines don't start one */
+static void json_text(const char *s, size_t n)
+{
+    if (!json_text_open) {
+        while (n > 0 && *s == '\n') {
+            s++;
+            n--;
+        }
+        if (n == 0) {
+            return;
+        }
+        json_begin(out_fd);
+        json_key("text");
+        put("\"", 1);
+        json_text_open = 1;
+    }
+    put_escaped(s, n);
+}
+
+void json_begin(int fd)
+{
+    use_fd(fd);
+    json_close_text();
+    json_depth = 0;
+    json_first[0] = 1;
+    json_keyed = 0;
+    json_open('{');
+    json_key("section");
+    json_string(json_section, strlen(json_section));
+}
+
+void json_end(void)
+{
+    json_close('}');
+    put("\n", 1);
+}
+
+void json_key(const char *key)
+{
+    json_sep();
+    put("\"", 1);
+    put_escaped(key, strlen(key));
+    put("\":", 2);
+    json_keyed = 1;
+}
+
+void json_open(char c)
+{
+    json_sep();
+    put(&c, 1);
+    if (json_depth < JSON_MAX_DEPTH - 1) {
+        json_depth++;
+    }
+    json_first[json_depth] = 1;
+}
+
+void json_close(char c)
+{
+    put(&c, 1);
+    if (json_depth > 0) {
+        json_depth--;
+    }
+}
+
+void json_uint(unsigned v)
+{
+    char digits[10];
+    int n = sizeof(digits);
+
+    json_sep();
+    do {
+        digits[--n] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    put(digits + n, sizeof(digits) - n);
+}
+
+void json_string(const char *s, size_t len)
+{
+    json_sep();
+    put("\"", 1);
+    put_escaped(s, len);
+    put("\"", 1);
+}
+
+void report_section(int fd, const char *name)
+{
+    size_t len = strlen(name);
+    char *p;
+
+    if (fd < 0) {
+        return;
+    }
+    if (report_json) {
+        use_fd(fd);
+        json_close_text();
+        json_section = name;
+        return;
+    }
+    p = report_reserve(fd, len + 3);
+    if (!p) {
+        return;
+    }
+    *p++ = '[';
+    memcpy(p, name, len);
+    p += len;
+    *p++ = ']';
+    *p++ = '\n';
+    report_commit(p);
+}
+
+void report_vprintf(int fd, const char *fmt, va_list ap)
+{
+    char *p = report_reserve(fd, REPORT_LINE_MAX);
+    int len;
+
+    len = vsnprintf(p, REPORT_LINE_MAX, fmt, ap);
+    if (len >= REPORT_LINE_MAX) {
+        len = REPORT_LINE_MAX - 1;
+    }
+    if (len > 0) {
+        report_commit(p + len);
+    }
+}
+
+/* Log information into the crash_report */
+void report_out(int rfd, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (rfd >= 0) {
+        va_start(ap, fmt);
+        report_vprintf(rfd, fmt, ap);
+        va_end(ap);
+    }
+}
+
+void report_write(int fd, const void *data, size_t len)
+{
+    char *p;
+
+    if (len == 0) {
+        return;
+    }
+    use_fd(fd);
+    if (report_json) {
+        json_text(data, len);
+        return;
+    }
+    if (len + sizeof(report_rec) + 3 <= buf_size - buf_len) {
+        p = report_reserve(fd, len);
+        memcpy(p, data, len);
+        report_commit(p + len);
+        return;
+    }
+    write_block(REC_TEXT, data, len);
+}
+
+char *report_reserve(int fd, size_t len)
+{
+    size_t need = len;
+
+    use_fd(fd);
+    if (report_binary) {
+        need += sizeof(report_rec) + 3;
+    }
+    /* JSON text is escaped on the way into the buffer */
+    if (need > buf_size || report_json) {
+        reserved_line = 1;
+        return len <= REPORT_LINE_MAX ? line : NULL;
+    }
+    reserved_line = 0;
+    if (buf_size - buf_len < need) {
+        report_flush();
+    }
+    if (report_binary && text_at < 0) {
+        text_at = buf_len;
+        buf_len += sizeof(report_rec);
+    }
+    return buf + buf_len;
+}
+
+void report_commit(char *end)
+{
+    /* buf may well end where line starts, so the address can't tell */
+    if (reserved_line) {
+        if (report_json) {
+            json_text(line, end - line);
+        } else {
+            write_block(REC_TEXT, line, end - line);
+        }
+        return;
+    }
+    buf_len = end - buf;
+}
+
+void report_record(int fd, unsigned type, const void *data, size_t len)
+{
+    report_rec rec;
+
+    use_fd(fd);
+    close_text();
+    if (sizeof(rec) + REC_PAD(len) > buf_size - buf_len) {
+        write_block(type, data, len);
+        return;
+    }
+    rec.type = type;
+    rec.len = len;
+    memcpy(buf + buf_len, &rec, sizeof(rec));
+    memcpy(buf + buf_len + sizeof(rec), data, len);
+    memset(buf + buf_len + sizeof(rec) + len, 0, REC_PAD(len) - len);
+    buf_len += sizeof(rec) + REC_PAD(len);
+}
@@ -0,0 +1,136 @@
+/* report-writer.h - buffered output for the crash report
+**
+** Copyright 2011,2012 Sony Network Entertainment
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef __report_writer_h
+#define __report_writer_h
+
+#include <stdarg.h>
+#include <stddef.h>
+
+/* longest line that report_vprintf() writes; the rest is cut off */
+#define REPORT_LINE_MAX 512
+
+/* Collect report output in buf (of size bytes) from now on, and have it
+ * written out if the handler itself is killed by a fault.  Without a
+ * buffer, each piece of output is written as it comes.
+ */
+extern void report_init(char *buf, size_t size);
+
+/* where the report is going, or -1 */
+extern int report_fd;
+
+/* Add formatted output for fd */
+extern void report_vprintf(int fd, const char *fmt, va_list ap);
+extern void report_out(int rfd, const char *fmt, ...);
+
+/* Add len bytes for fd.  A block too big for the buffer is written out
+ * along with what is in it, in one writev().
+ */
+extern void report_write(int fd, const void *data, size_t len);
+
+/* Room for len bytes of output for fd, to be filled in directly and
+ * then added with report_commit(end of what was filled in).  There is
+ * always room for REPORT_LINE_MAX bytes; NULL is returned for more than
+ * that if the buffer can't hold them.
+ */
+extern char *report_reserve(int fd, size_t len);
+extern void report_commit(char *end);
+
+/* Write out everything collected so far */
+extern void report_flush(void);
+
+/* Start the section called name, as the "[name]" line of a text report */
+extern void report_section(int fd, const char *name);
+
+/*
+ * Binary reports.  With report_binary set, a report is a series of
+ * records, each a report_rec followed by len bytes of data, padded to a
+ * multiple of 4 bytes, all in the byte order of the device.  Text output
+ * goes into REC_TEXT records, and the bulky parts of a report are added
+ * as records of their own, to be made into text by crash_handler --render.
+ */
+#define REPORT_MAGIC    0x31524843  /* "CHR1", the data of REC_START */
+
+#define REC_START       1   /* first in the file */
+#define REC_TEXT        2   /* text, as it goes into a text report */
+#define REC_MAPS        3   /* the maps file, and the build-ids */
+#define REC_REGS        4   /* r0-pc and cpsr */
+#define REC_PC_CODE     5   /* pc, and the code around it */
+#define REC_FRAMES      6   /* a backtrace */
+#define REC_STACK       7   /* the stack dump, and the code with it */
+#define REC_KLOG        8   /* the tail of the kernel log */
+
+typedef struct report_rec {
+    unsigned type;  /* REC_* */
+    unsigned len;   /* bytes of data after this, not counting padding */
+} report_rec;
+
+#define REC_PAD(len)    (((len) + 3) & ~3)
+
+extern int report_binary;
+
+/* Add a record to a binary report for fd */
+extern void report_record(int fd, unsigned type, const void *data,
+                          size_t len);
+
+/*
+ * JSON reports.  With report_json set, a report is newline-delimited
+ * JSON: one object per line, each with the name of the section it
+ * belongs to in "section".  Text output goes into a "text" string, and
+ * the structured parts of a report are written with the calls below,
+ * straight into the output as they are made:
+ *   json_begin(fd);            {"section":"registers"
+ *   json_key("pc");            ,"pc":
+ *   json_uint(pc);             1234
+ *   json_end();                }
+ * with json_open()/json_close() around arrays ('[', ']') and nested
+ * objects ('{', '}').  Commas are put in as needed.
+ */
+extern int report_json;
+
+extern void json_begin(int fd);
+extern void json_end(void);
+extern void json_key(const char *key);
+extern void json_open(char c);
+extern void json_close(char c);
+extern void json_uint(unsigned v);
+/* len bytes of s, escaped; bytes outside ASCII are taken as Latin-1 */
+extern void json_string(const char *s, size_t len);
+
+extern const char report_hex[16];
+
+/* v at p as "%08x" prints it; returns the end */
+static inline char *fmt_hex32(char *p, unsigned v)
+{
+    int i;
+
+    for (i = 7; i >= 0; i--) {
+        p[i] = report_hex[v & 15];
+        v >>= 4;
+    }
+    return p + 8;
+}
+
+/* the low byte of v at p as "%02x" prints it; returns the end */
+static inline char *fmt_hex8(char *p, unsigned v)
+{
+    p[0] = report_hex[(v >> 4) & 15];
+    p[1] = report_hex[v & 15];
+    return p + 2;
+}
+
+#endif
@@ -0,0 +1,231 @@
+/*
+ * stack-scan.c - fast search of the stack for words that point into code
+ *
+ * Copyright 2011,2012 Sony Network Entertainment
+ *
+ * The best-guess unwinder looks at every word of the stack, and almost
+ * none of them are return addresses.  Before any map lookups or
+ * instruction fetches, the words are run through a filter that only
+ * lets through those within a few wide ranges around the executable
+ * maps.  The filter does several words per step with NEON or SSE2/AVX2,
+ * where the compiler has them turned on, and one at a time otherwise.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "stack-scan.h"
+#include "arena.h"
+
+static int compare_gap(const void *a, const void *b)
+{
+    const unsigned *ga = a;
+    const unsigned *gb = b;
+
+    /* biggest gap first */
+    if (ga[0] > gb[0]) return -1;
+    if (ga[0] < gb[0]) return 1;
+    return 0;
+}
+
+static int compare_unsigned(const void *a, const void *b)
+{
+    unsigned ua = *(const unsigned *)a;
+    unsigned ub = *(const unsigned *)b;
+
+    return (ua > ub) - (ua < ub);
+}
+
+/*
+ * With more maps than ranges, the maps are split at the biggest gaps
+ * between them, and each group becomes one range.
+ */
+void codefilter_init(codefilter *cf, const maptable *mt, unsigned back)
+{
+    unsigned (*gap)[2] = NULL;
+    unsigned split[MAX_FILTER_RANGES];
+    unsigned first, last;
+    int nsplit, i, j;
+
+    cf->count = 0;
+    if (mt->count == 0) {
+        return;
+    }
+
+    /* if there's no memory for the gaps, one range covers everything */
+    nsplit = 0;
+    if (mt->count > 1) {
+        gap = arena_alloc((mt->count - 1) * sizeof(*gap));
+    }
+    if (gap) {
+        for (i = 1; i < mt->count; i++) {
+            gap[i-1][0] = mt->map[i].start - mt->map[i-1].end;
+            gap[i-1][1] = i;
+        }
+        qsort(gap, mt->count - 1, sizeof(*gap), compare_gap);
+        for (i = 0; i < mt->count - 1 && nsplit < MAX_FILTER_RANGES - 1;
+             i++) {
+            if (gap[i][0] == 0) {
+                break;
+            }
+            split[nsplit++] = gap[i][1];
+        }
+        arena_free(gap);
+        qsort(split, nsplit, sizeof(unsigned), compare_unsigned);
+    }
+    split[nsplit] = mt->count;
+
+    for (i = 0, j = 0; j <= nsplit; j++) {
+        first = mt->map[i].start;
+        last = mt->map[split[j] - 1].end;
+        cf->start[cf->count] = first + back;
+        cf->size[cf->count] = last - first;
+        cf->count++;
+        i = split[j];
+    }
+}
+
+/* One word at a time, for the tail of a block and for plain builds */
+static int scan_words(const codefilter *cf, const unsigned *words, int from,
+                      int n, int *hits, int nhits)
+{
+    int i, r;
+
+    for (i = from; i < n; i++) {
+        for (r = 0; r < cf->count; r++) {
+            if (words[i] - cf->start[r] < cf->size[r]) {
+                hits[nhits++] = i;
+                break;
+            }
+        }
+    }
+    return nhits;
+}
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+int codefilter_scan(const codefilter *cf, const unsigned *words, int n,
+                    int *hits)
+{
+    uint32x4_t start[MAX_FILTER_RANGES], size[MAX_FILTER_RANGES];
+    uint32x4_t w, in;
+    uint32x2_t any;
+    unsigned lane[4];
+    int nhits = 0;
+    int i, r, k;
+
+    for (r = 0; r < cf->count; r++) {
+        start[r] = vdupq_n_u32(cf->start[r]);
+        size[r] = vdupq_n_u32(cf->size[r]);
+    }
+    for (i = 0; i + 4 <= n; i += 4) {
+        w = vld1q_u32(words + i);
+        in = vdupq_n_u32(0);
+        for (r = 0; r < cf->count; r++) {
+            in = vorrq_u32(in, vcltq_u32(vsubq_u32(w, start[r]), size[r]));
+        }
+        any = vorr_u32(vget_low_u32(in), vget_high_u32(in));
+        if ((vget_lane_u32(any, 0) | vget_lane_u32(any, 1)) == 0) {
+            continue;
+        }
+        vst1q_u32(lane, in);
+        for (k = 0; k < 4; k++) {
+            if (lane[k]) {
+                hits[nhits++] = i + k;
+            }
+        }
+    }
+    return scan_words(cf, words, i, n, hits, nhits);
+}
+
+#elif defined(__AVX2__)
+
+int codefilter_scan(const codefilter *cf, const unsigned *words, int n,
+                    int *hits)
+{
+    __m256i start[MAX_FILTER_RANGES], size[MAX_FILTER_RANGES];
+    __m256i sign = _mm256_set1_epi32(0x80000000);
+    __m256i w, in;
+    int nhits = 0;
+    int i, r, mask;
+
+    /* AVX2 only compares signed, so both sides are moved by 2^31 */
+    for (r = 0; r < cf->count; r++) {
+        start[r] = _mm256_set1_epi32(cf->start[r]);
+        size[r] = _mm256_set1_epi32(cf->size[r] ^ 0x80000000);
+    }
+    for (i = 0; i + 8 <= n; i += 8) {
+        w = _mm256_loadu_si256((const __m256i *)(words + i));
+        in = _mm256_setzero_si256();
+        for (r = 0; r < cf->count; r++) {
+            in = _mm256_or_si256(in, _mm256_cmpgt_epi32(size[r],
+                    _mm256_xor_si256(_mm256_sub_epi32(w, start[r]), sign)));
+        }
+        mask = _mm256_movemask_ps(_mm256_castsi256_ps(in));
+        while (mask) {
+            hits[nhits++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return scan_words(cf, words, i, n, hits, nhits);
+}
+
+#elif defined(__SSE2__)
+
+int codefilter_scan(const codefilter *cf, const unsigned *words, int n,
+                    int *hits)
+{
+    __m128i start[MAX_FILTER_RANGES], size[MAX_FILTER_RANGES];
+    __m128i sign = _mm_set1_epi32(0x80000000);
+    __m128i w, in;
+    int nhits = 0;
+    int i, r, mask;
+
+    /* SSE2 only compares signed, so both sides are moved by 2^31 */
+    for (r = 0; r < cf->count; r++) {
+        start[r] = _mm_set1_epi32(cf->start[r]);
+        size[r] = _mm_set1_epi32(cf->size[r] ^ 0x80000000);
+    }
+    for (i = 0; i + 4 <= n; i += 4) {
+        w = _mm_loadu_si128((const __m128i *)(words + i));
+        in = _mm_setzero_si128();
+        for (r = 0; r < cf->count; r++) {
+            in = _mm_or_si128(in, _mm_cmplt_epi32(
+                    _mm_xor_si128(_mm_sub_epi32(w, start[r]), sign), size[r]));
+        }
+        mask = _mm_movemask_ps(_mm_castsi128_ps(in));
+        while (mask) {
+            hits[nhits++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return scan_words(cf, words, i, n, hits, nhits);
+}
+
+#else
+
+int codefilter_scan(const codefilter *cf, const unsigned *words, int n,
+                    int *hits)
+{
+    return scan_words(cf, words, 0, n, hits, 0);
+}
+
+#endif
@@ -0,0 +1,52 @@
+/* stack-scan.h - fast search of the stack for words that point into code
+**
+** Copyright 2011,2012 Sony Network Entertainment
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef __stack_scan_h
+#define __stack_scan_h
+
+#include "utility.h"
+
+/* number of address ranges a codefilter checks each word against */
+#define MAX_FILTER_RANGES 8
+
+/*
+ * A coarse picture of where the executable maps are: at most
+ * MAX_FILTER_RANGES ranges that between them cover all of them.  Words
+ * outside every range can't be code addresses; words inside one still
+ * have to be checked against the map table.
+ */
+typedef struct codefilter {
+    int count;
+    unsigned start[MAX_FILTER_RANGES];
+    unsigned size[MAX_FILTER_RANGES];
+} codefilter;
+
+/* Set up cf for the maps in mt.  Words are tested as (word - back), so
+ * that return addresses just past the end of a map count, and those less
+ * than back bytes into it don't.  back = 2 lets in the return address
+ * (with its Thumb bit) of a 16-bit BLX at the very start of a map.
+ */
+extern void codefilter_init(codefilter *cf, const maptable *mt,
+                            unsigned back);
+
+/* Put the index of each of the n words that passes the filter in hits,
+ * in order.  Returns the number of hits.
+ */
+extern int codefilter_scan(const codefilter *cf, const unsigned *words,
+                           int n, int *hits);
+
+#endif
@@ -33,21 +33,24 @@
  ****************************************************************************/
 
 #include <sys/types.h>
+#include <string.h>
 #include <unwind.h>
 
 #include "utility.h"
+#include "memreader.h"
+#include "arena.h"
 
 /* We add a prototype for abort here to avoid creating a dependency on
    target headers.  */
 extern void abort (void);
 
-/* Derived from _Unwind_VRS_Pop to use ptrace */
+/* Derived from _Unwind_VRS_Pop to read a remote stack */
 extern _Unwind_VRS_Result 
 unwind_VRS_Pop_with_ptrace (_Unwind_Context *context, 
                             _Unwind_VRS_RegClass regclass, 
                             _uw discriminator, 
                             _Unwind_VRS_DataRepresentation representation, 
-                            pid_t pid);
+                            memreader *mr);
 
 typedef struct _ZSt9type_info type_info; /* This names C++ type_info type */
 
@@ -79,11 +82,11 @@ typedef struct
 
 #define CODE_FINISH (0xb0)
 
-/* Derived from next_unwind_byte to use ptrace */
+/* Derived from next_unwind_byte to read remote memory */
 /* Return the next byte of unwinding information, or CODE_FINISH if there is
    no data remaining.  */
 static inline _uw8
-next_unwind_byte_with_ptrace (__gnu_unwind_state * uws, pid_t pid)
+next_unwind_byte_with_ptrace (__gnu_unwind_state * uws, memreader *mr)
 {
   _uw8 b;
 
@@ -93,7 +96,7 @@ next_unwind_byte_with_ptrace (__gnu_unwind_state * uws, pid_t pid)
       if (uws->words_left == 0)
 	return CODE_FINISH; /* Nothing left.  */
       uws->words_left--;
-      uws->data = get_remote_word(pid, uws->next);
+      uws->data = mr_read_word(mr, (_uw) uws->next);
       uws->next++;
       uws->bytes_left = 3;
     }
@@ -106,240 +109,347 @@ next_unwind_byte_with_ptrace (__gnu_unwind_state * uws, pid_t pid)
   return b;
 }
 
-/* Execute the unwinding instructions described by UWS.  */
-_Unwind_Reason_Code
-unwind_execute_with_ptrace(_Unwind_Context * context, __gnu_unwind_state * uws,
-                           pid_t pid)
+/* Unwinding instructions are decoded once per function into a short list
+   of these, kept for the rest of the run, so that a function that shows up
+   in many frames (recursion, or the same call chain in several threads)
+   doesn't have its bytecode fetched and parsed over again.  */
+
+enum
+{
+  UOP_VSP_ADD,		/* vsp += arg */
+  UOP_VSP_REG,		/* vsp = r[arg] */
+  UOP_POP,		/* pop registers: regclass, discriminator arg */
+  UOP_FINISH,		/* done; copy lr to pc unless arg says pc was popped */
+  UOP_REFUSE		/* refuse to unwind */
+};
+
+typedef struct
+{
+  _uw8 kind;
+  _uw8 regclass;
+  _uw8 representation;
+  _uw arg;
+} unwind_op;
+
+/* Number of functions whose decoded instructions are kept.  Direct
+   mapped: a function that collides simply replaces the older one.  */
+#define UNWIND_OP_CACHE_SIZE	256
+
+/* Longest possible instruction list: 3 bytes in the first word, up to 255
+   more words, and the final UOP_FINISH.  */
+#define MAX_UNWIND_OPS		(3 + 255 * 4 + 1)
+
+static struct
+{
+  _uw fnstart;
+  const unwind_op *ops;
+} unwind_op_cache[UNWIND_OP_CACHE_SIZE];
+
+static inline unsigned
+unwind_op_slot (_uw fnstart)
+{
+  return ((fnstart >> 1) ^ (fnstart >> 9)) & (UNWIND_OP_CACHE_SIZE - 1);
+}
+
+/* Append a pop of registers to the decoded instructions.  */
+static inline unwind_op *
+add_pop (unwind_op *op, _Unwind_VRS_RegClass regclass, _uw discriminator,
+	 _Unwind_VRS_DataRepresentation representation)
+{
+  op->kind = UOP_POP;
+  op->regclass = regclass;
+  op->representation = representation;
+  op->arg = discriminator;
+  return op + 1;
+}
+
+/* Append a vsp adjustment, folding it into the previous one if there is
+   one right before it.  */
+static inline unwind_op *
+add_vsp_add (unwind_op *ops, unwind_op *op, _uw offset)
+{
+  if (op > ops && op[-1].kind == UOP_VSP_ADD)
+    {
+      op[-1].arg += offset;
+      return op;
+    }
+  op->kind = UOP_VSP_ADD;
+  op->arg = offset;
+  return op + 1;
+}
+
+/* Decode the unwinding instructions described by UWS into OPS, which must
+   have room for MAX_UNWIND_OPS entries.  Returns the
+   number of entries used; the last one is UOP_FINISH or UOP_REFUSE.  */
+static int
+decode_unwind_ops (__gnu_unwind_state * uws, unwind_op *ops, memreader *mr)
 {
-  _uw op;
+  unwind_op *op = ops;
+  _uw code;
   int set_pc;
-  _uw reg;
 
   set_pc = 0;
   for (;;)
     {
-      op = next_unwind_byte_with_ptrace (uws, pid);
-      if (op == CODE_FINISH)
+      code = next_unwind_byte_with_ptrace (uws, mr);
+      if (code == CODE_FINISH)
 	{
 	  /* If we haven't already set pc then copy it from lr.  */
-	  if (!set_pc)
-	    {
-	      _Unwind_VRS_Get (context, _UVRSC_CORE, R_LR, _UVRSD_UINT32,
-			       &reg);
-	      _Unwind_VRS_Set (context, _UVRSC_CORE, R_PC, _UVRSD_UINT32,
-			       &reg);
-	      set_pc = 1;
-	    }
-	  /* Drop out of the loop.  */
+	  op->kind = UOP_FINISH;
+	  op->arg = set_pc;
+	  op++;
 	  break;
 	}
-      if ((op & 0x80) == 0)
+      if ((code & 0x80) == 0)
 	{
 	  /* vsp = vsp +- (imm6 << 2 + 4).  */
 	  _uw offset;
 
-	  offset = ((op & 0x3f) << 2) + 4;
-	  _Unwind_VRS_Get (context, _UVRSC_CORE, R_SP, _UVRSD_UINT32, &reg);
-	  if (op & 0x40)
-	    reg -= offset;
-	  else
-	    reg += offset;
-	  _Unwind_VRS_Set (context, _UVRSC_CORE, R_SP, _UVRSD_UINT32, &reg);
+	  offset = ((code & 0x3f) << 2) + 4;
+	  op = add_vsp_add (ops, op, (code & 0x40) ? -offset : offset);
 	  continue;
 	}
       
-      if ((op & 0xf0) == 0x80)
+      if ((code & 0xf0) == 0x80)
 	{
-	  op = (op << 8) | next_unwind_byte_with_ptrace (uws, pid);
-	  if (op == 0x8000)
+	  code = (code << 8) | next_unwind_byte_with_ptrace (uws, mr);
+	  if (code == 0x8000)
 	    {
 	      /* Refuse to unwind.  */
-	      return _URC_FAILURE;
+	      goto refuse;
 	    }
 	  /* Pop r4-r15 under mask.  */
-	  op = (op << 4) & 0xfff0;
-	  if (unwind_VRS_Pop_with_ptrace (context, _UVRSC_CORE, op, _UVRSD_UINT32, 
-                                      pid)
-	      != _UVRSR_OK)
-	    return _URC_FAILURE;
-	  if (op & (1 << R_PC))
+	  code = (code << 4) & 0xfff0;
+	  op = add_pop (op, _UVRSC_CORE, code, _UVRSD_UINT32);
+	  if (code & (1 << R_PC))
 	    set_pc = 1;
 	  continue;
 	}
-      if ((op & 0xf0) == 0x90)
+      if ((code & 0xf0) == 0x90)
 	{
-	  op &= 0xf;
-	  if (op == 13 || op == 15)
+	  code &= 0xf;
+	  if (code == 13 || code == 15)
 	    /* Reserved.  */
-	    return _URC_FAILURE;
+	    goto refuse;
 	  /* vsp = r[nnnn].  */
-	  _Unwind_VRS_Get (context, _UVRSC_CORE, op, _UVRSD_UINT32, &reg);
-	  _Unwind_VRS_Set (context, _UVRSC_CORE, R_SP, _UVRSD_UINT32, &reg);
+	  op->kind = UOP_VSP_REG;
+	  op->arg = code;
+	  op++;
 	  continue;
 	}
-      if ((op & 0xf0) == 0xa0)
+      if ((code & 0xf0) == 0xa0)
 	{
 	  /* Pop r4-r[4+nnn], [lr].  */
 	  _uw mask;
 	  
-	  mask = (0xff0 >> (7 - (op & 7))) & 0xff0;
-	  if (op & 8)
+	  mask = (0xff0 >> (7 - (code & 7))) & 0xff0;
+	  if (code & 8)
 	    mask |= (1 << R_LR);
-	  if (unwind_VRS_Pop_with_ptrace (context, _UVRSC_CORE, mask, _UVRSD_UINT32,
-                                      pid)
-	      != _UVRSR_OK)
-	    return _URC_FAILURE;
+	  op = add_pop (op, _UVRSC_CORE, mask, _UVRSD_UINT32);
 	  continue;
 	}
-      if ((op & 0xf0) == 0xb0)
+      if ((code & 0xf0) == 0xb0)
 	{
-	  /* op == 0xb0 already handled.  */
-	  if (op == 0xb1)
+	  /* code == 0xb0 already handled.  */
+	  if (code == 0xb1)
 	    {
-	      op = next_unwind_byte_with_ptrace (uws, pid);
-	      if (op == 0 || ((op & 0xf0) != 0))
+	      code = next_unwind_byte_with_ptrace (uws, mr);
+	      if (code == 0 || ((code & 0xf0) != 0))
 		/* Spare.  */
-		return _URC_FAILURE;
+		goto refuse;
 	      /* Pop r0-r4 under mask.  */
-	      if (unwind_VRS_Pop_with_ptrace (context, _UVRSC_CORE, op, 
-                                          _UVRSD_UINT32, pid)
-		  != _UVRSR_OK)
-		return _URC_FAILURE;
+	      op = add_pop (op, _UVRSC_CORE, code, _UVRSD_UINT32);
 	      continue;
 	    }
-	  if (op == 0xb2)
+	  if (code == 0xb2)
 	    {
 	      /* vsp = vsp + 0x204 + (uleb128 << 2).  */
+	      _uw offset = 0;
 	      int shift;
 
-	      _Unwind_VRS_Get (context, _UVRSC_CORE, R_SP, _UVRSD_UINT32,
-			       &reg);
-	      op = next_unwind_byte_with_ptrace (uws, pid);
+	      code = next_unwind_byte_with_ptrace (uws, mr);
 	      shift = 2;
-	      while (op & 0x80)
+	      while (code & 0x80)
 		{
-		  reg += ((op & 0x7f) << shift);
+		  offset += ((code & 0x7f) << shift);
 		  shift += 7;
-		  op = next_unwind_byte_with_ptrace (uws, pid);
+		  code = next_unwind_byte_with_ptrace (uws, mr);
 		}
-	      reg += ((op & 0x7f) << shift) + 0x204;
-	      _Unwind_VRS_Set (context, _UVRSC_CORE, R_SP, _UVRSD_UINT32,
-			       &reg);
+	      offset += ((code & 0x7f) << shift) + 0x204;
+	      op = add_vsp_add (ops, op, offset);
 	      continue;
 	    }
-	  if (op == 0xb3)
+	  if (code == 0xb3)
 	    {
 	      /* Pop VFP registers with fldmx.  */
-	      op = next_unwind_byte_with_ptrace (uws, pid);
-	      op = ((op & 0xf0) << 12) | ((op & 0xf) + 1);
-	      if (unwind_VRS_Pop_with_ptrace (context, _UVRSC_VFP, op, _UVRSD_VFPX, 
-                                          pid)
-		  != _UVRSR_OK)
-		return _URC_FAILURE;
+	      code = next_unwind_byte_with_ptrace (uws, mr);
+	      code = ((code & 0xf0) << 12) | ((code & 0xf) + 1);
+	      op = add_pop (op, _UVRSC_VFP, code, _UVRSD_VFPX);
 	      continue;
 	    }
-	  if ((op & 0xfc) == 0xb4)
+	  if ((code & 0xfc) == 0xb4)
 	    {
 	      /* Pop FPA E[4]-E[4+nn].  */
-	      op = 0x40000 | ((op & 3) + 1);
-	      if (unwind_VRS_Pop_with_ptrace (context, _UVRSC_FPA, op, _UVRSD_FPAX, 
-                                          pid)
-		  != _UVRSR_OK)
-		return _URC_FAILURE;
+	      code = 0x40000 | ((code & 3) + 1);
+	      op = add_pop (op, _UVRSC_FPA, code, _UVRSD_FPAX);
 	      continue;
 	    }
-	  /* op & 0xf8 == 0xb8.  */
+	  /* code & 0xf8 == 0xb8.  */
 	  /* Pop VFP D[8]-D[8+nnn] with fldmx.  */
-	  op = 0x80000 | ((op & 7) + 1);
-	  if (unwind_VRS_Pop_with_ptrace (context, _UVRSC_VFP, op, _UVRSD_VFPX, pid)
-	      != _UVRSR_OK)
-	    return _URC_FAILURE;
+	  code = 0x80000 | ((code & 7) + 1);
+	  op = add_pop (op, _UVRSC_VFP, code, _UVRSD_VFPX);
 	  continue;
 	}
-      if ((op & 0xf0) == 0xc0)
+      if ((code & 0xf0) == 0xc0)
 	{
-	  if (op == 0xc6)
+	  if (code == 0xc6)
 	    {
 	      /* Pop iWMMXt D registers.  */
-	      op = next_unwind_byte_with_ptrace (uws, pid);
-	      op = ((op & 0xf0) << 12) | ((op & 0xf) + 1);
-	      if (unwind_VRS_Pop_with_ptrace (context, _UVRSC_WMMXD, op, 
-                                          _UVRSD_UINT64, pid)
-		  != _UVRSR_OK)
-		return _URC_FAILURE;
+	      code = next_unwind_byte_with_ptrace (uws, mr);
+	      code = ((code & 0xf0) << 12) | ((code & 0xf) + 1);
+	      op = add_pop (op, _UVRSC_WMMXD, code, _UVRSD_UINT64);
 	      continue;
 	    }
-	  if (op == 0xc7)
+	  if (code == 0xc7)
 	    {
-	      op = next_unwind_byte_with_ptrace (uws, pid);
-	      if (op == 0 || (op & 0xf0) != 0)
+	      code = next_unwind_byte_with_ptrace (uws, mr);
+	      if (code == 0 || (code & 0xf0) != 0)
 		/* Spare.  */
-		return _URC_FAILURE;
+		goto refuse;
 	      /* Pop iWMMXt wCGR{3,2,1,0} under mask.  */
-	      if (unwind_VRS_Pop_with_ptrace (context, _UVRSC_WMMXC, op, 
-                                          _UVRSD_UINT32, pid)
-		  != _UVRSR_OK)
-		return _URC_FAILURE;
+	      op = add_pop (op, _UVRSC_WMMXC, code, _UVRSD_UINT32);
 	      continue;
 	    }
-	  if ((op & 0xf8) == 0xc0)
+	  if ((code & 0xf8) == 0xc0)
 	    {
 	      /* Pop iWMMXt wR[10]-wR[10+nnn].  */
-	      op = 0xa0000 | ((op & 0xf) + 1);
-	      if (unwind_VRS_Pop_with_ptrace (context, _UVRSC_WMMXD, op, 
-                                          _UVRSD_UINT64, pid)
-		  != _UVRSR_OK)
-		return _URC_FAILURE;
+	      code = 0xa0000 | ((code & 0xf) + 1);
+	      op = add_pop (op, _UVRSC_WMMXD, code, _UVRSD_UINT64);
 	      continue;
 	    }
-	  if (op == 0xc8)
+	  if (code == 0xc8)
 	    {
 #ifndef __VFP_FP__
  	      /* Pop FPA registers.  */
- 	      op = next_unwind_byte_with_ptrace (uws, pid);
-	      op = ((op & 0xf0) << 12) | ((op & 0xf) + 1);
- 	      if (unwind_VRS_Pop_with_ptrace (context, _UVRSC_FPA, op, _UVRSD_FPAX,
-                                          pid)
- 		  != _UVRSR_OK)
- 		return _URC_FAILURE;
+ 	      code = next_unwind_byte_with_ptrace (uws, mr);
+	      code = ((code & 0xf0) << 12) | ((code & 0xf) + 1);
+	      op = add_pop (op, _UVRSC_FPA, code, _UVRSD_FPAX);
  	      continue;
 #else
               /* Pop VFPv3 registers D[16+ssss]-D[16+ssss+cccc] with vldm.  */
-              op = next_unwind_byte_with_ptrace (uws, pid);
-              op = (((op & 0xf0) + 16) << 12) | ((op & 0xf) + 1);
-              if (unwind_VRS_Pop_with_ptrace (context, _UVRSC_VFP, op, 
-                                              _UVRSD_DOUBLE, pid)
-                  != _UVRSR_OK)
-                return _URC_FAILURE;
+              code = next_unwind_byte_with_ptrace (uws, mr);
+              code = (((code & 0xf0) + 16) << 12) | ((code & 0xf) + 1);
+	      op = add_pop (op, _UVRSC_VFP, code, _UVRSD_DOUBLE);
               continue;
 #endif
 	    }
-	  if (op == 0xc9)
+	  if (code == 0xc9)
 	    {
 	      /* Pop VFP registers with fldmd.  */
-	      op = next_unwind_byte_with_ptrace (uws, pid);
-	      op = ((op & 0xf0) << 12) | ((op & 0xf) + 1);
-	      if (unwind_VRS_Pop_with_ptrace (context, _UVRSC_VFP, op, 
-                                          _UVRSD_DOUBLE, pid)
-		  != _UVRSR_OK)
-		return _URC_FAILURE;
+	      code = next_unwind_byte_with_ptrace (uws, mr);
+	      code = ((code & 0xf0) << 12) | ((code & 0xf) + 1);
+	      op = add_pop (op, _UVRSC_VFP, code, _UVRSD_DOUBLE);
 	      continue;
 	    }
 	  /* Spare.  */
-	  return _URC_FAILURE;
+	  goto refuse;
 	}
-      if ((op & 0xf8) == 0xd0)
+      if ((code & 0xf8) == 0xd0)
 	{
 	  /* Pop VFP D[8]-D[8+nnn] with fldmd.  */
-	  op = 0x80000 | ((op & 7) + 1);
-	  if (unwind_VRS_Pop_with_ptrace (context, _UVRSC_VFP, op, _UVRSD_DOUBLE, 
-                                      pid)
-	      != _UVRSR_OK)
-	    return _URC_FAILURE;
+	  code = 0x80000 | ((code & 7) + 1);
+	  op = add_pop (op, _UVRSC_VFP, code, _UVRSD_DOUBLE);
 	  continue;
 	}
       /* Spare.  */
-      return _URC_FAILURE;
+      goto refuse;
     }
-  return _URC_OK;
+  return op - ops;
+
+ refuse:
+  op->kind = UOP_REFUSE;
+  op++;
+  return op - ops;
+}
+
+/* Run decoded unwinding instructions against CONTEXT.  */
+static _Unwind_Reason_Code
+run_unwind_ops (_Unwind_Context * context, const unwind_op *op, memreader *mr)
+{
+  _uw reg;
+
+  for (;; op++)
+    {
+      switch (op->kind)
+	{
+	case UOP_VSP_ADD:
+	  _Unwind_VRS_Get (context, _UVRSC_CORE, R_SP, _UVRSD_UINT32, &reg);
+	  reg += op->arg;
+	  _Unwind_VRS_Set (context, _UVRSC_CORE, R_SP, _UVRSD_UINT32, &reg);
+	  break;
+
+	case UOP_VSP_REG:
+	  _Unwind_VRS_Get (context, _UVRSC_CORE, op->arg, _UVRSD_UINT32, &reg);
+	  _Unwind_VRS_Set (context, _UVRSC_CORE, R_SP, _UVRSD_UINT32, &reg);
+	  break;
+
+	case UOP_POP:
+	  if (unwind_VRS_Pop_with_ptrace (context, op->regclass, op->arg,
+					  op->representation, mr)
+	      != _UVRSR_OK)
+	    return _URC_FAILURE;
+	  break;
+
+	case UOP_FINISH:
+	  if (!op->arg)
+	    {
+	      _Unwind_VRS_Get (context, _UVRSC_CORE, R_LR, _UVRSD_UINT32,
+			       &reg);
+	      _Unwind_VRS_Set (context, _UVRSC_CORE, R_PC, _UVRSD_UINT32,
+			       &reg);
+	    }
+	  return _URC_OK;
+
+	default:
+	  return _URC_FAILURE;
+	}
+    }
+}
+
+/* Execute the unwinding instructions of the function at FNSTART, if they
+   have been decoded before.  Returns _URC_NO_REASON if they haven't.  */
+_Unwind_Reason_Code
+unwind_execute_cached (_Unwind_Context * context, _uw fnstart, memreader *mr)
+{
+  unsigned slot = unwind_op_slot (fnstart);
+
+  if (!unwind_op_cache[slot].ops || unwind_op_cache[slot].fnstart != fnstart)
+    return _URC_NO_REASON;
+  return run_unwind_ops (context, unwind_op_cache[slot].ops, mr);
+}
+
+/* Execute the unwinding instructions described by UWS, which belong to
+   the function at FNSTART, and keep them for the next time round.  */
+_Unwind_Reason_Code
+unwind_execute_with_ptrace(_Unwind_Context * context, __gnu_unwind_state * uws,
+                           _uw fnstart, memreader *mr)
+{
+  unwind_op ops[MAX_UNWIND_OPS];
+  unwind_op *keep;
+  unsigned slot;
+  int n;
+
+  n = decode_unwind_ops (uws, ops, mr);
+
+  /* if the arena is full, just don't keep them */
+  keep = arena_alloc (n * sizeof (unwind_op));
+  if (keep)
+    {
+      memcpy (keep, ops, n * sizeof (unwind_op));
+      slot = unwind_op_slot (fnstart);
+      unwind_op_cache[slot].fnstart = fnstart;
+      unwind_op_cache[slot].ops = keep;
+    }
+
+  return run_unwind_ops (context, ops, mr);
 }
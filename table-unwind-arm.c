@@ -42,6 +42,7 @@
 #include <unwind.h>
 #include <errno.h>
 #include "utility.h"
+#include "memreader.h"
 #include "crash_handler.h"
 
 typedef struct _ZSt9type_info type_info; /* This names C++ type_info type */
@@ -159,29 +160,35 @@ typedef struct __EIT_entry
   _uw content;
 } __EIT_entry;
 
-/* Derived version to use ptrace */
+/* Derived version to read remote memory */
 typedef _Unwind_Reason_Code (*personality_routine_with_ptrace)
            (_Unwind_State,
 			_Unwind_Control_Block *,
 			_Unwind_Context *,
-            pid_t);
+            memreader *);
 
-/* Derived version to use ptrace */
+/* Derived version to read remote memory */
 /* ABI defined personality routines.  */
 static _Unwind_Reason_Code unwind_cpp_pr0_with_ptrace (_Unwind_State,
-    _Unwind_Control_Block *, _Unwind_Context *, pid_t);
+    _Unwind_Control_Block *, _Unwind_Context *, memreader *);
 static _Unwind_Reason_Code unwind_cpp_pr1_with_ptrace (_Unwind_State,
-    _Unwind_Control_Block *, _Unwind_Context *, pid_t);
+    _Unwind_Control_Block *, _Unwind_Context *, memreader *);
 static _Unwind_Reason_Code unwind_cpp_pr2_with_ptrace (_Unwind_State,
-    _Unwind_Control_Block *, _Unwind_Context *, pid_t);
+    _Unwind_Control_Block *, _Unwind_Context *, memreader *);
 
-/* Execute the unwinding instructions described by UWS.  */
+/* Execute the unwinding instructions described by UWS, for the function
+   at FNSTART, and keep them decoded.  */
 extern _Unwind_Reason_Code
 unwind_execute_with_ptrace(_Unwind_Context * context, __gnu_unwind_state * uws,
-                           pid_t pid);
+                           _uw fnstart, memreader *mr);
 
-/* Derived version to use ptrace. Only handles core registers. Disregards
- * FP and others. 
+/* Execute the kept instructions of the function at FNSTART, or return
+   _URC_NO_REASON if there aren't any.  */
+extern _Unwind_Reason_Code
+unwind_execute_cached (_Unwind_Context * context, _uw fnstart, memreader *mr);
+
+/* Derived version to read remote memory. Only handles core registers.
+ * Disregards FP and others. 
  */
 /* ABI defined function to pop registers off the stack.  */
 
@@ -189,7 +196,7 @@ _Unwind_VRS_Result unwind_VRS_Pop_with_ptrace (_Unwind_Context *context,
 				    _Unwind_VRS_RegClass regclass,
 				    _uw discriminator,
 				    _Unwind_VRS_DataRepresentation representation,
-                    pid_t pid)
+                    memreader *mr)
 {
   phase1_vrs *vrs = (phase1_vrs *) context;
 
@@ -210,7 +217,7 @@ _Unwind_VRS_Result unwind_VRS_Pop_with_ptrace (_Unwind_Context *context,
 	for (i = 0; i < 16; i++)
 	  {
 	    if (mask & (1 << i)) {
-	      vrs->core.r[i] = get_remote_word(pid, ptr);
+	      vrs->core.r[i] = mr_read_word(mr, (_uw) ptr);
           ptr++;
         }
 	  }
@@ -230,9 +237,9 @@ _Unwind_VRS_Result unwind_VRS_Pop_with_ptrace (_Unwind_Context *context,
 /* Calculate the address encoded by a 31-bit self-relative offset at address
    P.  */
 static inline _uw
-selfrel_offset31 (const _uw *p, pid_t pid)
+selfrel_offset31 (const _uw *p, memreader *mr)
 {
-  _uw offset = get_remote_word(pid, (void*)p);
+  _uw offset = mr_read_word(mr, (_uw) p);
 
   //offset = *p;
   /* Sign extend to 32 bits.  */
@@ -250,7 +257,7 @@ selfrel_offset31 (const _uw *p, pid_t pid)
 
 static const __EIT_entry *
 search_EIT_table (const __EIT_entry * table, int nrec, _uw return_address,
-                  pid_t pid)
+                  memreader *mr)
 {
   _uw next_fn;
   _uw this_fn;
@@ -265,9 +272,9 @@ search_EIT_table (const __EIT_entry * table, int nrec, _uw return_address,
   while (1)
     {
       n = (left + right) / 2;
-      this_fn = selfrel_offset31 (&table[n].fnoffset, pid);
+      this_fn = selfrel_offset31 (&table[n].fnoffset, mr);
       if (n != nrec - 1)
-	next_fn = selfrel_offset31 (&table[n + 1].fnoffset, pid) - 1;
+	next_fn = selfrel_offset31 (&table[n + 1].fnoffset, mr) - 1;
       else
 	next_fn = (_uw)0 - 1;
 
@@ -284,13 +291,41 @@ search_EIT_table (const __EIT_entry * table, int nrec, _uw return_address,
     }
 }
 
+/* Binary search the decoded function starts of an object instead, which
+   needs no reads at all.  */
+
+static const __EIT_entry *
+search_fn_index (const elfobj *obj, _uw return_address)
+{
+  _uw addr = return_address - obj->bias;
+  int left, right, n;
+
+  if (obj->fn_count == 0 || addr < obj->fn_index[0])
+    return (__EIT_entry *) 0;
+
+  /* Find the last function starting at or before addr.  */
+  left = 0;
+  right = obj->fn_count - 1;
+  while (left < right)
+    {
+      n = (left + right + 1) / 2;
+      if (obj->fn_index[n] <= addr)
+	left = n;
+      else
+	right = n - 1;
+    }
+  return (__EIT_entry *) obj->exidx_start + left;
+}
+
 /* Find the exception index table eintry for the given address. */
 static const __EIT_entry*
-get_eitp(_uw return_address, pid_t pid, mapinfo *map, mapinfo **containing_map)
+get_eitp(_uw return_address, memreader *mr, maptable *map,
+         mapinfo **containing_map)
 {
   const __EIT_entry *eitp = NULL;
   int nrec;
   mapinfo *mi;
+  const elfobj *obj;
   
   /* The return address is the address of the instruction following the
      call instruction (plus one in thumb mode).  If this was the last
@@ -300,17 +335,20 @@ get_eitp(_uw return_address, pid_t pid, mapinfo *map, mapinfo **containing_map)
   if (return_address >= 2)
       return_address -= 2;
 
-  for (mi = map; mi != NULL; mi = mi->next) {
-    if (return_address >= mi->start && return_address <= mi->end) break;
-  }
+  mi = find_mapinfo(map, return_address);
 
   if (mi) {
     if (containing_map) *containing_map = mi;
-    eitp = (__EIT_entry *) mi->exidx_start;
+    obj = get_elfobj(mr, map, mi);
+    if (!obj)
+      return NULL;
+    if (obj->fn_index)
+      return search_fn_index (obj, return_address);
+    eitp = (__EIT_entry *) obj->exidx_start;
     DLOG("get_eitp: eitp (exidx_start) =%p\n", eitp);
-    nrec = (mi->exidx_end - mi->exidx_start)/sizeof(__EIT_entry);
+    nrec = (obj->exidx_end - obj->exidx_start)/sizeof(__EIT_entry);
     DLOG("get_eitp: nrec =%d\n", nrec);
-    eitp = search_EIT_table (eitp, nrec, return_address, pid);
+    eitp = search_EIT_table (eitp, nrec, return_address, mr);
     DLOG("get_eitp: eitp (result) =%p\n", eitp);
   }
   return eitp;
@@ -321,12 +359,12 @@ get_eitp(_uw return_address, pid_t pid, mapinfo *map, mapinfo **containing_map)
    Returns _URC_FAILURE if an error occurred, _URC_OK on success.  */
 
 static _Unwind_Reason_Code
-get_eit_entry (_Unwind_Control_Block *ucbp, _uw return_address, pid_t pid, 
-               mapinfo *map, mapinfo **containing_map)
+get_eit_entry (_Unwind_Control_Block *ucbp, _uw return_address, 
+               memreader *mr, maptable *map, mapinfo **containing_map)
 {
   const __EIT_entry *eitp;
   
-  eitp = get_eitp(return_address, pid, map, containing_map);
+  eitp = get_eitp(return_address, mr, map, containing_map);
 
   if (!eitp)
     {
@@ -334,9 +372,9 @@ get_eit_entry (_Unwind_Control_Block *ucbp, _uw return_address, pid_t pid,
       UCB_PR_ADDR (ucbp) = 0;
       return _URC_FAILURE;
     }
-  ucbp->pr_cache.fnstart = selfrel_offset31 (&eitp->fnoffset, pid);
+  ucbp->pr_cache.fnstart = selfrel_offset31 (&eitp->fnoffset, mr);
 
-  _uw eitp_content = get_remote_word(pid, (void *)&eitp->content);
+  _uw eitp_content = mr_read_word(mr, (_uw) &eitp->content);
 
   /* Can this frame be unwound at all?  */
   if (eitp_content == EXIDX_CANTUNWIND)
@@ -359,15 +397,15 @@ get_eit_entry (_Unwind_Control_Block *ucbp, _uw return_address, pid_t pid,
       /* The low 31 bits of the content field are a self-relative
 	 offset to an _Unwind_EHT_Entry structure.  */
       ucbp->pr_cache.ehtp =
-	(_Unwind_EHT_Header *) selfrel_offset31 (&eitp->content, pid);
+	(_Unwind_EHT_Header *) selfrel_offset31 (&eitp->content, mr);
       ucbp->pr_cache.additional = 0;
     }
 
   /* Discover the personality routine address.  */
-  if (get_remote_word(pid, ucbp->pr_cache.ehtp) & (1u << 31))
+  if (mr_read_word(mr, (_uw) ucbp->pr_cache.ehtp) & (1u << 31))
     {
       /* One of the predefined standard routines.  */
-      _uw idx = (get_remote_word(pid, ucbp->pr_cache.ehtp) >> 24) & 0xf;
+      _uw idx = (mr_read_word(mr, (_uw) ucbp->pr_cache.ehtp) >> 24) & 0xf;
       if (idx == 0)
 	UCB_PR_ADDR (ucbp) = (_uw) &unwind_cpp_pr0_with_ptrace;
       else if (idx == 1)
@@ -384,7 +422,7 @@ get_eit_entry (_Unwind_Control_Block *ucbp, _uw return_address, pid_t pid,
   else
     {
       /* Execute region offset to PR */
-      UCB_PR_ADDR (ucbp) = selfrel_offset31 (ucbp->pr_cache.ehtp, pid);
+      UCB_PR_ADDR (ucbp) = selfrel_offset31 (ucbp->pr_cache.ehtp, mr);
       /* Since we are unwinding the stack from a different process, it is
        * impossible to execute the personality routine in debuggerd. Punt here.
        */
@@ -394,20 +432,58 @@ get_eit_entry (_Unwind_Control_Block *ucbp, _uw return_address, pid_t pid,
   return _URC_OK;
 }
 
-/* Print out the current call level, pc, and module name in the crash log */
-static _Unwind_Reason_Code log_function(_Unwind_Context *context, pid_t pid, 
-                                        int stack_level,
-                                        mapinfo *map,
-                                        unsigned int sp_list[])
+/* Roll a return address back to the call instruction before it.
+ * Thumb mode - need to check whether the bl(x) has long offset or not.
+ * Examples:
+ *
+ * arm blx in the middle of thumb:
+ * 187ae:       2300            movs    r3, #0
+ * 187b0:       f7fe ee1c       blx     173ec
+ * 187b4:       2c00            cmp     r4, #0
+ *
+ * arm bl in the middle of thumb:
+ * 187d8:       1c20            adds    r0, r4, #0
+ * 187da:       f136 fd15       bl      14f208
+ * 187de:       2800            cmp     r0, #0
+ *
+ * pure thumb:
+ * 18894:       189b            adds    r3, r3, r2
+ * 18896:       4798            blx     r3
+ * 18898:       b001            add     sp, #4
+ */
+unsigned return_to_call_site(memreader *mr, unsigned ret)
+{
+    unsigned pc = ret;
+
+    if (pc & 1) {
+        _uw prev_word;
+        pc = (pc & ~1);
+        prev_word = mr_read_word(mr, pc-4);
+        // Long offset 
+        if ((prev_word & 0xf0000000) == 0xf0000000 && 
+            (prev_word & 0x0000e000) == 0x0000e000) {
+            pc -= 4;
+        }
+        else {
+            pc -= 2;
+        }
+    }
+    else { 
+        pc -= 4;
+    }
+    return pc;
+}
+
+/* Add the current call level to the backtrace, with its pc rolled back to
+ * the call site.  Returns what frametable_add() does.
+ */
+static int record_frame(_Unwind_Context *context, memreader *mr,
+                        frametable *frames)
 {
     _uw pc;
-    _uw rel_pc; 
     phase2_vrs *vrs = (phase2_vrs*) context;
-    const mapinfo *mi;
+    int stack_level = frames->count;
 
-    if (stack_level < STACK_CONTENT_DEPTH) {
-        sp_list[stack_level] = vrs->core.r[R_SP];
-    }
     pc = vrs->core.r[R_PC];
 
     // Top level frame
@@ -416,75 +492,112 @@ static _Unwind_Reason_Code log_function(_Unwind_Context *context, pid_t pid,
     }
     // For deeper framers, rollback pc by one instruction
     else {
-        pc = vrs->core.r[R_PC];
-        /* Thumb mode - need to check whether the bl(x) has long offset or not.
-         * Examples:
-         *
-         * arm blx in the middle of thumb:
-         * 187ae:       2300            movs    r3, #0
-         * 187b0:       f7fe ee1c       blx     173ec
-         * 187b4:       2c00            cmp     r4, #0
-         *
-         * arm bl in the middle of thumb:
-         * 187d8:       1c20            adds    r0, r4, #0
-         * 187da:       f136 fd15       bl      14f208
-         * 187de:       2800            cmp     r0, #0
-         *
-         * pure thumb:
-         * 18894:       189b            adds    r3, r3, r2
-         * 18896:       4798            blx     r3
-         * 18898:       b001            add     sp, #4
-         */
-        if (pc & 1) {
-            _uw prev_word;
-            pc = (pc & ~1);
-            prev_word = get_remote_word(pid, (void *) pc-4);
-            // Long offset 
-            if ((prev_word & 0xf0000000) == 0xf0000000 && 
-                (prev_word & 0x0000e000) == 0x0000e000) {
-                pc -= 4;
+        pc = return_to_call_site(mr, pc);
+    }
+
+    return frametable_add(frames, pc, vrs->core.r[R_SP], FRAME_TABLE);
+}
+
+/* Unwind from the registers in saved_vrs, adding frames as it goes.  If
+ * recorded is set, the first frame is in frames already and is only
+ * unwound.  Why it stopped is left in frames->stop.
+ */
+static int unwind_frames(memreader *mr, maptable *map, frametable *frames,
+                         phase1_vrs *saved_vrs, int recorded)
+{
+    _Unwind_Reason_Code code = _URC_OK;
+    _Unwind_Control_Block ucb;
+    _Unwind_Control_Block *ucbp = &ucb;
+    int added = 0;
+
+    do {
+        mapinfo *this_map = NULL;
+
+        frames->stop_pc = saved_vrs->core.r[R_PC];
+        frames->stop_sp = saved_vrs->core.r[R_SP];
+
+        /* Find the entry for this routine.  */
+        code = get_eit_entry(ucbp, saved_vrs->core.r[R_PC], mr, map, &this_map);
+        if (code == _URC_END_OF_STACK) {
+            /* EXIDX_CANTUNWIND: the outermost frame */
+            if (!recorded) {
+                record_frame ((_Unwind_Context *) saved_vrs, mr, frames);
             }
-            else {
-                pc -= 2;
+            break;
+        }
+        if (code != _URC_OK) {
+            /* The caller is known, even though it can't be unwound; keep
+             * it, unless the pc is plainly not in code.  Where the
+             * unwinder stopped is reported with the frames (see
+             * dump_backtrace).
+             */
+            if (!recorded && addr_in_code(map, saved_vrs->core.r[R_PC])) {
+                record_frame ((_Unwind_Context *) saved_vrs, mr, frames);
             }
+            frames->stop = FRAMES_NO_TABLE;
+            code = _URC_FAILURE;
+            break;
         }
-        else { 
-            pc -= 4;
+
+        /* The dwarf unwinder assumes the context structure holds things
+        like the function and LSDA pointers.  The ARM implementation
+        caches these in the exception header (UCB).  To avoid
+        rewriting everything we make the virtual IP register point at
+        the UCB.  */
+        _Unwind_SetGR((_Unwind_Context *)saved_vrs, 12, (_Unwind_Ptr) ucbp);
+
+        /* Add this frame; a frame seen before means the unwinder is
+         * going round in circles.
+         */
+        if (!recorded) {
+            added = record_frame ((_Unwind_Context *) saved_vrs, mr, frames);
+            if (added != 0) {
+                code = _URC_FAILURE;
+                break;
+            }
         }
-    }
+        recorded = 0;
 
-    /* We used to print the absolute PC in the back trace, and mask out the top
-     * 3 bits to guesstimate the offset in the .so file. This is not working for
-     * non-prelinked libraries since the starting offset may not be aligned on 
-     * 1MB boundaries, and the library may be larger than 1MB. So for .so 
-     * addresses we print the relative offset in back trace.
+        /* Call the pr to decide what to do.  */
+        code = ((personality_routine_with_ptrace) UCB_PR_ADDR (ucbp))(
+                _US_VIRTUAL_UNWIND_FRAME | _US_FORCE_UNWIND, ucbp, 
+                (void *) saved_vrs, mr);
+    /* 
+     * In theory the unwinding process will stop when the end of stack is
+     * reached or there is no unwinding information for the code address.
+     * The frame budget (frames->limit) and the (pc, sp) check above make
+     * sure it stops on a corrupt stack too.
      */
-    rel_pc = pc;
-    mi = pc_to_mapinfo(map, pc, &rel_pc);
-
-    LOG("         #%02d  pc %08x  %s\n", stack_level, rel_pc, 
-         mi ? mi->name : "");
+    } while (code != _URC_END_OF_STACK && code != _URC_FAILURE);
 
-    return _URC_NO_REASON;
+    /* a failed personality routine leaves stop_pc and stop_sp at the
+     * frame it was working on
+     */
+    if (added > 0) {
+        frames->stop = FRAMES_LOOP;
+    } else if (added < 0) {
+        frames->stop = FRAMES_LIMIT;
+    } else if (code == _URC_FAILURE) {
+        frames->stop = FRAMES_NO_TABLE;
+    } else {
+        frames->stop = FRAMES_END;
+    }
+    return frames->count;
 }
 
-/* Derived from __gnu_Unwind_Backtrace to use ptrace */
-/* Perform stack backtrace using data from the unwind tables.
+/* Derived from __gnu_Unwind_Backtrace to read a remote process */
+/* Perform stack backtrace using data from the unwind tables, into frames.
+ * Why it stopped is left in frames->stop.
  * Return the level of stack it unwinds.
  */
-int table_unwind_backtrace_with_ptrace(pid_t pid, mapinfo *map, 
-                                 unsigned int sp_list[], int *frame0_pc_sane)
+int table_unwind_backtrace_with_ptrace(memreader *mr, maptable *map, 
+                                 frametable *frames, int *frame0_pc_sane)
 {
     phase1_vrs saved_vrs;
-    _Unwind_Reason_Code code = _URC_OK;
     struct pt_regs r;
     int i;
-    int stack_level = 0;
 
-    _Unwind_Control_Block ucb;
-    _Unwind_Control_Block *ucbp = &ucb;
-
-    if(ptrace(PTRACE_GETREGS, pid, 0, &r)) {
+    if(mr_get_regs(mr, &r)) {
         LOG("cannot get registers: %d (%s)\n", errno, strerror(errno));
 	return 0;
     }
@@ -503,65 +616,34 @@ int table_unwind_backtrace_with_ptrace(pid_t pid, mapinfo *map,
      * Instead, we simply print out the 0 as the top frame, and resume the 
      * unwinding process with the value stored in LR.
      */
-    if (get_eitp(saved_vrs.core.r[R_PC], pid, map, NULL) == NULL) { 
+    if (get_eitp(saved_vrs.core.r[R_PC], mr, map, NULL) == NULL) { 
         *frame0_pc_sane = 0;
-        log_function ((_Unwind_Context *) &saved_vrs, pid, stack_level, 
-                      map, sp_list);
+        record_frame ((_Unwind_Context *) &saved_vrs, mr, frames);
         saved_vrs.core.r[R_PC] = saved_vrs.core.r[R_LR];
-        stack_level++;
     }
 
-    do {
-        mapinfo *this_map = NULL;
-        /* Find the entry for this routine.  */
-        if (get_eit_entry(ucbp, saved_vrs.core.r[R_PC], pid, map, &this_map)
-            != _URC_OK) {
-            /* Uncomment the code below to study why the unwinder failed */
-#if 1 
-            /* Shed more debugging info for stack unwinder improvement */
-            if (this_map) {
-                LOG("Relative PC=%#x from %s not contained in EXIDX\n", 
-                     saved_vrs.core.r[R_PC] - this_map->start, this_map->name);
-            }
-            LOG("PC=%#x SP=%#x\n", 
-                 saved_vrs.core.r[R_PC], saved_vrs.core.r[R_SP]);
-#endif
-            code = _URC_FAILURE;
-            break;
-        }
+    return unwind_frames(mr, map, frames, &saved_vrs, 0);
+}
 
-        /* The dwarf unwinder assumes the context structure holds things
-        like the function and LSDA pointers.  The ARM implementation
-        caches these in the exception header (UCB).  To avoid
-        rewriting everything we make the virtual IP register point at
-        the UCB.  */
-        _Unwind_SetGR((_Unwind_Context *)&saved_vrs, 12, (_Unwind_Ptr) ucbp);
+/* Carry on with the unwind tables from the last frame in frames, whose
+ * registers (as far as they are known) are in regs.
+ */
+int table_unwind_continue(memreader *mr, maptable *map, frametable *frames,
+                          const struct pt_regs *regs)
+{
+    phase1_vrs saved_vrs;
+    int i;
 
-        /* Call log function.  */
-        if (log_function ((_Unwind_Context *) &saved_vrs, pid, stack_level,
-                          map, sp_list) != _URC_NO_REASON) {
-            code = _URC_FAILURE;
-            break;
-        }
-        stack_level++;
+    for (i = 0; i < 16; i++) {
+        saved_vrs.core.r[i] = regs->uregs[i];
+    }
+    saved_vrs.demand_save_flags = ~(_uw) 0;
 
-        /* Call the pr to decide what to do.  */
-        code = ((personality_routine_with_ptrace) UCB_PR_ADDR (ucbp))(
-                _US_VIRTUAL_UNWIND_FRAME | _US_FORCE_UNWIND, ucbp, 
-                (void *) &saved_vrs, pid);
-    /* 
-     * In theory the unwinding process will stop when the end of stack is
-     * reached or there is no unwinding information for the code address.
-     * To add another level of guarantee that the unwinding process
-     * will terminate we will stop it when the STACK_CONTENT_DEPTH is reached.
-     */
-    } while (code != _URC_END_OF_STACK && code != _URC_FAILURE && 
-             stack_level < STACK_CONTENT_DEPTH);
-    return stack_level;
+    return unwind_frames(mr, map, frames, &saved_vrs, frames->count > 0);
 }
 
 
-/* Derived version to use ptrace */
+/* Derived version to read remote memory */
 /* Common implementation for ARM ABI defined personality routines.
    ID is the index of the personality routine, other arguments are as defined
    by __aeabi_unwind_cpp_pr{0,1,2}.  */
@@ -571,16 +653,23 @@ unwind_pr_common_with_ptrace (_Unwind_State state,
 			_Unwind_Control_Block *ucbp,
 			_Unwind_Context *context,
 			int id,
-            pid_t pid)
+            memreader *mr)
 {
   __gnu_unwind_state uws;
   _uw *data;
+  _Unwind_Reason_Code code;
   int phase2_call_unexpected_after_unwind = 0;
 
   state &= _US_ACTION_MASK;
 
+  /* Functions seen in an earlier frame don't need their table entry
+     looked at again.  */
+  code = unwind_execute_cached (context, ucbp->pr_cache.fnstart, mr);
+  if (code != _URC_NO_REASON)
+    return code == _URC_OK ? _URC_CONTINUE_UNWIND : _URC_FAILURE;
+
   data = (_uw *) ucbp->pr_cache.ehtp;
-  uws.data = get_remote_word(pid, data);
+  uws.data = mr_read_word(mr, (_uw) data);
   data++;
   uws.next = data;
   if (id == 0)
@@ -604,7 +693,7 @@ unwind_pr_common_with_ptrace (_Unwind_State state,
   if ((ucbp->pr_cache.additional & 1) == 0)
     {
       /* Process descriptors.  */
-      while (get_remote_word(pid, data)) {
+      while (mr_read_word(mr, (_uw) data)) {
       /**********************************************************************
        * The original code here seems to deal with exceptions that are not
        * applicable in our toolchain, thus there is no way to test it for now.
@@ -618,7 +707,8 @@ unwind_pr_common_with_ptrace (_Unwind_State state,
 	  /* Finished processing this descriptor.  */
     }
 
-  if (unwind_execute_with_ptrace (context, &uws, pid) != _URC_OK)
+  if (unwind_execute_with_ptrace (context, &uws, ucbp->pr_cache.fnstart, mr)
+      != _URC_OK)
     return _URC_FAILURE;
 
   if (phase2_call_unexpected_after_unwind)
@@ -639,25 +729,25 @@ static _Unwind_Reason_Code
 unwind_cpp_pr0_with_ptrace (_Unwind_State state,
 			_Unwind_Control_Block *ucbp,
 			_Unwind_Context *context,
-            pid_t pid)
+            memreader *mr)
 {
-  return unwind_pr_common_with_ptrace (state, ucbp, context, 0, pid);
+  return unwind_pr_common_with_ptrace (state, ucbp, context, 0, mr);
 }
 
 static _Unwind_Reason_Code
 unwind_cpp_pr1_with_ptrace (_Unwind_State state,
 			_Unwind_Control_Block *ucbp,
 			_Unwind_Context *context,
-            pid_t pid)
+            memreader *mr)
 {
-  return unwind_pr_common_with_ptrace (state, ucbp, context, 1, pid);
+  return unwind_pr_common_with_ptrace (state, ucbp, context, 1, mr);
 }
 
 static _Unwind_Reason_Code
 unwind_cpp_pr2_with_ptrace (_Unwind_State state,
 			_Unwind_Control_Block *ucbp,
 			_Unwind_Context *context,
-            pid_t pid)
+            memreader *mr)
 {
-  return unwind_pr_common_with_ptrace (state, ucbp, context, 2, pid);
+  return unwind_pr_common_with_ptrace (state, ucbp, context, 2, mr);
 }
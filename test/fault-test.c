@@ -32,6 +32,30 @@ void do_fault(void)
 	c = *(char *)ptr;
 }
 
+/* fault with the frame pointer cleared, as it often is in code built
+ * with -fomit-frame-pointer.  The unwind tables still have to get a
+ * backtrace out of it.
+ */
+void do_fault_zero_fp(void)
+{
+	fault_log("inside do_fault_zero_fp");
+
+	/* the load faults, so the frame pointer is never needed again,
+	 * and isn't listed as clobbered (gcc won't have it when the
+	 * function uses one)
+	 */
+#if defined(__thumb__)
+	asm volatile("movs r7, #0\n\tmovs r0, #0\n\tldr r0, [r0]"
+		     ::: "r0", "memory");
+#elif defined(__arm__)
+	asm volatile("mov r11, #0\n\tmov r0, #0\n\tldr r0, [r0]"
+		     ::: "r0", "memory");
+#endif
+	do_fault();
+}
+
+int zero_fp;
+
 void delay_then_fault(int count)
 {
 	int i;
@@ -42,16 +66,26 @@ void delay_then_fault(int count)
 		sleep(1);
 	}
 	fault_log("I was minding my own business, when...");
-	do_fault();
+	if (zero_fp) {
+		do_fault_zero_fp();
+	} else {
+		do_fault();
+	}
 }
 
 int main(int argc, char **argv)
 {
 	int count = 5;
 
+	if (argc>1 && strcmp(argv[1], "-z")==0) {
+		zero_fp = 1;
+		argc--;
+		argv++;
+	}
 	if (argc>1) {
 		if (strcmp(argv[1], "-h")==0 || strcmp(argv[1],"--help")==0) {
-			printf("Usage fault-test [<delay>]\n");
+			printf("Usage fault-test [-z] [<delay>]\n");
+			printf("  -z  fault with the frame pointer set to 0\n");
 			exit(0);
 		}
 		count = atoi(argv[1]);
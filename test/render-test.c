@@ -0,0 +1,182 @@
+/*
+ * render-test.c - check that a binary report renders back to the text
+ * report it stands for
+ *
+ * The same made-up crash is written once as a text report and once as
+ * a binary one, and the binary one is put through render_report().  The
+ * two texts have to match byte for byte.  This runs on the host:
+ *   $ make check
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "arena.h"
+#include "report-render.h"
+#include "crash_handler.h"
+
+#define STACK_BASE  0xbef00000
+#define STACK_WORDS 256
+
+static const char maps_text[] =
+    "00008000-00009000 r-xp 00000000 b3:01 1001       /usr/bin/fault-test\n"
+    "00010000-00011000 rw-p 00000000 00:00 0          [heap]\n"
+    "b6f00000-b6f3e000 r-xp 00000000 b3:01 1638       /lib/libc.so.6\n"
+    "b6f3e000-b6f40000 rw-p 0003e000 b3:01 1638       /lib/libc.so.6\n"
+    "bef00000-bef21000 rw-p 00000000 00:00 0          [stack]\n";
+
+static unsigned stack[STACK_WORDS];
+static char report_buffer[4096];
+
+static int read_stack_word(struct memreader *mr, unsigned addr)
+{
+    if (addr < STACK_BASE || addr >= STACK_BASE + sizeof(stack)) {
+        return -1;
+    }
+    return stack[(addr - STACK_BASE) / 4];
+}
+
+static maptable *make_maps(void)
+{
+    maptable *map = arena_calloc(1, sizeof(maptable));
+    char *text = arena_alloc(sizeof(maps_text));
+    int i;
+
+    memcpy(text, maps_text, sizeof(maps_text));
+    parse_maps_text(map, text, sizeof(maps_text) - 1, NULL);
+    for (i = 0; i < map->nobj; i++) {
+        if (strstr(map->obj[i].name, "libc")) {
+            map->obj[i].build_id_len = 20;
+            memset(map->obj[i].build_id, 0x3f, 20);
+        }
+    }
+    return map;
+}
+
+/* write the whole crash to path, in the form report_binary says */
+static void write_crash(const char *path, maptable *map)
+{
+    unsigned regs[NUM_REPORT_REGS], code[PC_CODE_WORDS];
+    unsigned magic = REPORT_MAGIC;
+    frameinfo frame[12];
+    frametable frames;
+    stackdump sd;
+    int i;
+
+    report_fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+    if (report_binary) {
+        report_record(report_fd, REC_START, &magic, sizeof(magic));
+    }
+    report_section(report_fd, "memory maps");
+    write_memory_maps(map);
+    LOG("\n");
+    report_flush();
+
+    for (i = 0; i < NUM_REPORT_REGS; i++) {
+        regs[i] = 0x1000 * i;
+    }
+    regs[13] = STACK_BASE + 0x100;
+    regs[14] = 0xb6f01235;
+    regs[15] = 0x00008124;
+    write_registers(regs, map);
+    for (i = 0; i < PC_CODE_WORDS; i++) {
+        code[i] = 0xe1a00000 + i;
+    }
+    write_pc_code(regs[15], code);
+
+    /* a recursion of two frames, to be folded, and then a stop */
+    memset(&frames, 0, sizeof(frames));
+    frames.frame = frame;
+    for (i = 0; i < 12; i++) {
+        frame[i].pc = i < 2 ? 0x8124 + i*8 : (i & 1 ? 0xb6f01230 : 0x8200);
+        frame[i].sp = STACK_BASE + 0x100 + i*16;
+        frame[i].method = i & 3;
+    }
+    frames.count = 12;
+    frames.stop = FRAMES_NO_TABLE;
+    frames.stop_pc = 0xb6f02000;
+    frames.stop_sp = STACK_BASE + 0x200;
+    report_section(report_fd, "call stack");
+    start_backtrace("hybrid");
+    dump_backtrace(map, &frames);
+    LOG("\n");
+
+    for (i = 0; i < STACK_WORDS; i++) {
+        stack[i] = i % 5 ? STACK_BASE + i*4 : 0xb6f01000 + i;
+    }
+    memset(&sd, 0, sizeof(sd));
+    sd.code_addr = 0x8110;
+    memcpy(sd.code, code, sizeof(sd.code));
+    sd.start = STACK_BASE + 0xc0;
+    sd.end = frame[11].sp;
+    sd.nsp = frames.count;
+    for (i = 0; i < sd.nsp; i++) {
+        sd.sp[i] = frame[i].sp;
+    }
+    sd.read_word = read_stack_word;
+    write_stack_and_code(map, &sd);
+
+    LOG("--- done ---\n");
+    report_flush();
+    close(report_fd);
+}
+
+static char *read_file(const char *path, int *size)
+{
+    char *data;
+    int fd = open(path, O_RDONLY);
+
+    *size = lseek(fd, 0, SEEK_END);
+    data = malloc(*size + 1);
+    pread(fd, data, *size, 0);
+    close(fd);
+    return data;
+}
+
+int main(void)
+{
+    char text_path[] = "/tmp/render-test-text.XXXXXX";
+    char bin_path[] = "/tmp/render-test-bin.XXXXXX";
+    char out_path[] = "/tmp/render-test-out.XXXXXX";
+    char *text, *out;
+    int text_size, bin_size, out_size, fd, ok;
+    maptable *map;
+
+    close(mkstemp(text_path));
+    close(mkstemp(bin_path));
+    fd = mkstemp(out_path);
+
+    report_init(report_buffer, sizeof(report_buffer));
+    map = make_maps();
+
+    report_binary = 0;
+    write_crash(text_path, map);
+    report_binary = 1;
+    write_crash(bin_path, map);
+
+    if (render_report(bin_path, fd)) {
+        printf("FAIL: %s did not render\n", bin_path);
+        return 1;
+    }
+    close(fd);
+
+    text = read_file(text_path, &text_size);
+    free(read_file(bin_path, &bin_size));
+    out = read_file(out_path, &out_size);
+    ok = text_size > 0 && out_size == text_size &&
+         memcmp(text, out, text_size) == 0;
+    if (ok) {
+        printf("PASS: %d byte binary report renders to the %d byte text one\n",
+               bin_size, text_size);
+        unlink(text_path);
+        unlink(bin_path);
+        unlink(out_path);
+    } else {
+        printf("FAIL: %s renders to %s, not %s\n", bin_path, out_path,
+               text_path);
+    }
+    return !ok;
+}
@@ -0,0 +1,168 @@
+/*
+ * unwind-test.c - check the McTernan unwinder on made-up ARM code
+ *
+ * Each case is a function, as ARM instruction words, that the unwinder
+ * interprets from its first instruction to its return, with the stack
+ * held in an array.  The return address and sp it reports have to be
+ * the ones the function returns with.  This runs on the host:
+ *   $ make check
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "unwarminder.h"
+#include "unwarm.h"
+
+#define CODE_BASE   0x00008000
+#define CODE_WORDS  8192
+#define STACK_BASE  0xbef00000
+#define STACK_WORDS 256
+
+#define RET_ADDR    0x00009124
+#define START_SP    (STACK_BASE + 0x200)
+
+static Int32 code[CODE_WORDS];
+static Int32 stack[STACK_WORDS];
+
+typedef struct report {
+    int count;
+    Int32 address;
+    Int32 sp;
+} report;
+
+static Boolean read_w(const Int32 a, Int32 *v)
+{
+    if (a >= CODE_BASE && a < CODE_BASE + sizeof(code)) {
+        *v = code[(a - CODE_BASE) / 4];
+    } else if (a >= STACK_BASE && a < STACK_BASE + sizeof(stack)) {
+        *v = stack[(a - STACK_BASE) / 4];
+    } else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static Boolean read_h(const Int32 a, Int16 *v)
+{
+    Int32 w;
+
+    if (!read_w(a & ~3, &w)) {
+        return FALSE;
+    }
+    *v = w >> ((a & 2) * 8);
+    return TRUE;
+}
+
+static Boolean read_b(const Int32 a, Int8 *v)
+{
+    Int32 w;
+
+    if (!read_w(a & ~3, &w)) {
+        return FALSE;
+    }
+    *v = w >> ((a & 3) * 8);
+    return TRUE;
+}
+
+/* only the first return matters, so stop there */
+static Boolean report_ret(void *data, Int32 address, Int32 sp)
+{
+    report *rep = data;
+
+    if (rep->count++ == 0) {
+        rep->address = address;
+        rep->sp = sp;
+    }
+    return FALSE;
+}
+
+static const UnwindCallbacks callbacks = {
+    report_ret,
+    read_w,
+    read_h,
+    read_b,
+    NULL,
+    NULL
+#if defined(UNW_DEBUG)
+   ,printf
+#endif
+};
+
+/* Unwind the code at CODE_BASE, entered with lr = RET_ADDR.  Returns 1
+ * if the unwind ends with expect, having returned to RET_ADDR with sp
+ * back at START_SP unless it was UNWIND_EXHAUSTED.
+ */
+static int check(const char *name, UnwResult expect)
+{
+    Int32 regs[16];
+    report rep;
+    UnwResult res;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        regs[i] = 0x1000 * i;
+    }
+    regs[13] = START_SP;
+    regs[14] = RET_ADDR;
+    regs[15] = CODE_BASE;
+    /* the stack holds no return address of its own */
+    memset(stack, 0, sizeof(stack));
+    memset(&rep, 0, sizeof(rep));
+
+    UnwindMemoReset();
+    res = UnwindStartRegs(regs, &callbacks, &rep);
+    if (res != expect || (expect == UNWIND_EXHAUSTED ? rep.count != 0 :
+        rep.count == 0 || rep.address != RET_ADDR || rep.sp != START_SP)) {
+        printf("FAIL: %s: result %d, returned %d times, first to 0x%08x "
+               "with sp 0x%08x\n", name, res, rep.count, rep.address, rep.sp);
+        return 0;
+    }
+    printf("PASS: %s\n", name);
+    return 1;
+}
+
+/* The return address is pushed with another register and popped into
+ * the pc, so each register has to be stored at its own address.
+ */
+static int test_push_pop(void)
+{
+    memset(code, 0, sizeof(code));
+    code[0] = 0xe92d4010;       /* push {r4, lr} */
+    code[1] = 0xe3a04000;       /* mov r4, #0 */
+    code[2] = 0xe8bd8010;       /* pop {r4, pc} */
+    return check("push {r4, lr} ... pop {r4, pc}", UNWIND_TRUNCATED);
+}
+
+/* The first function gets a quarter of UNW_MAX_INSTR_TOTAL, which is
+ * many times UNW_MAX_INSTR_COUNT, but the unwind still gives up on a
+ * function that doesn't return within it.
+ */
+static int test_long_function(void)
+{
+    int len = UNW_MAX_INSTR_TOTAL / 4 - 8;
+    int i, ok;
+
+    memset(code, 0, sizeof(code));
+    for (i = 0; i < len; i++) {
+        code[i] = 0xe1a00000;   /* nop */
+    }
+    code[len] = 0xe12fff1e;     /* bx lr */
+    ok = check("bx lr within a quarter of the total budget",
+               UNWIND_TRUNCATED);
+
+    code[len] = 0xe1a00000;
+    code[len + 8] = 0xe12fff1e;
+    ok &= check("bx lr past a quarter of the total budget",
+                UNWIND_EXHAUSTED);
+    return ok;
+}
+
+int main(void)
+{
+    int ok = 1;
+
+    ok &= test_push_pop();
+    ok &= test_long_function();
+    return !ok;
+}
@@ -0,0 +1,334 @@
+/*
+ * unwind-cache.c - on-disk cache of unwind indexes
+ *
+ * Copyright 2011,2012 Sony Network Entertainment
+ *
+ * A service that keeps crashing brings crash_handler back again and again
+ * to the same libraries.  The first time round, the unwind tables of each
+ * object the backtrace touches are saved in a file of their own, named
+ * after the object's build-id, which later crashes can just map in:
+ *
+ *   header
+ *   fn_count function starts (link-time, sorted, decoded from EXIDX)
+ *   the .ARM.exidx table, as it is in the file
+ *   the .ARM.extab section, as it is in the file (may be empty)
+ *
+ * Entries are evicted oldest first (by mtime, which is bumped on every
+ * hit) when the cache grows past its size limit.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "unwind-cache.h"
+#include "arena.h"
+#include "crash_handler.h"
+
+#define UCACHE_MAGIC	0x58495543	/* "UCIX" */
+#define UCACHE_VERSION	1
+
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID	3
+#endif
+
+/* longest build-id used for a key */
+#define MAX_KEY_BUILD_ID	24
+
+typedef struct ucache_header {
+    unsigned magic;
+    unsigned version;
+    unsigned load_vaddr;    /* link-time address of file offset 0 */
+    unsigned exidx_vaddr;
+    unsigned exidx_size;
+    unsigned extab_vaddr;
+    unsigned extab_size;
+    unsigned fn_count;
+} ucache_header;
+
+typedef struct ucache_file {
+    char name[64];
+    time_t mtime;
+    off_t size;
+} ucache_file;
+
+static const char *cache_dir;
+static size_t cache_max;
+
+void unwind_cache_init(const char *dir, size_t max_size)
+{
+    /* the parent is expected to be there already */
+    mkdir(dir, 0755);
+    cache_dir = dir;
+    cache_max = max_size;
+}
+
+/* Find the GNU build-id note in the program headers of a mapped file */
+static const unsigned char *find_build_id(const elfobj *obj, unsigned *len)
+{
+    const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *)obj->image;
+    const Elf32_Phdr *phdr;
+    const Elf32_Nhdr *nh;
+    const unsigned char *p, *end, *desc;
+    int i;
+
+    if (obj->image_size < sizeof(Elf32_Ehdr) ||
+        ehdr->e_ident[EI_CLASS] != ELFCLASS32 ||
+        ehdr->e_phoff + ehdr->e_phnum * sizeof(Elf32_Phdr) > obj->image_size) {
+        return NULL;
+    }
+    phdr = (const Elf32_Phdr *)(obj->image + ehdr->e_phoff);
+
+    for (i = 0; i < ehdr->e_phnum; i++) {
+        if (phdr[i].p_type != PT_NOTE ||
+            phdr[i].p_offset + phdr[i].p_filesz > obj->image_size) {
+            continue;
+        }
+        p = obj->image + phdr[i].p_offset;
+        end = p + phdr[i].p_filesz;
+        while (p + sizeof(Elf32_Nhdr) <= end) {
+            nh = (const Elf32_Nhdr *)p;
+            desc = p + sizeof(Elf32_Nhdr) + ((nh->n_namesz + 3) & ~3);
+            if (desc + nh->n_descsz > end) {
+                break;
+            }
+            if (nh->n_type == NT_GNU_BUILD_ID && nh->n_namesz == 4 &&
+                memcmp(p + sizeof(Elf32_Nhdr), "GNU", 4) == 0) {
+                *len = nh->n_descsz;
+                return desc;
+            }
+            p = desc + ((nh->n_descsz + 3) & ~3);
+        }
+    }
+    return NULL;
+}
+
+void unwind_cache_key(elfobj *obj, const struct stat *sb)
+{
+    const unsigned char *id;
+    unsigned len, i;
+
+    /* the header scan has usually found it already */
+    if (obj->build_id_len) {
+        id = obj->build_id;
+        len = obj->build_id_len;
+    } else if (obj->image) {
+        id = find_build_id(obj, &len);
+    } else {
+        id = NULL;
+    }
+    if (id && len > 0) {
+        if (len > MAX_KEY_BUILD_ID) {
+            len = MAX_KEY_BUILD_ID;
+        }
+        for (i = 0; i < len; i++) {
+            sprintf(obj->cache_key + i*2, "%02x", id[i]);
+        }
+    } else if (sb) {
+        snprintf(obj->cache_key, sizeof(obj->cache_key), "i%llx-%llx-%lx",
+                 (unsigned long long)sb->st_dev,
+                 (unsigned long long)sb->st_ino, (long)sb->st_mtime);
+    }
+}
+
+int unwind_cache_load(elfobj *obj)
+{
+    char path[PATH_MAX];
+    const ucache_header *hdr;
+    const unsigned char *p;
+    struct stat sb;
+    off_t body;
+    void *image;
+    int fd;
+
+    if (!cache_dir || !obj->cache_key[0]) {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/%s", cache_dir, obj->cache_key);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &sb) || sb.st_size < sizeof(ucache_header)) {
+        close(fd);
+        return -1;
+    }
+    image = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (image == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    /* size everything by subtracting from what is there, so a corrupt
+     * header cannot wrap the sums
+     */
+    hdr = image;
+    body = sb.st_size - sizeof(*hdr);
+    if (hdr->magic != UCACHE_MAGIC || hdr->version != UCACHE_VERSION ||
+        hdr->fn_count > body / 12 ||
+        hdr->exidx_size != hdr->fn_count * 8 ||
+        hdr->extab_size != body - (off_t)hdr->fn_count * 12) {
+        DLOG("unwind cache: %s is damaged\n", path);
+        munmap(image, sb.st_size);
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    /* mark it as recently used */
+    futimens(fd, NULL);
+    close(fd);
+
+    obj->bias = obj->base - hdr->load_vaddr;
+    obj->exidx_start = hdr->exidx_vaddr + obj->bias;
+    obj->exidx_end = obj->exidx_start + hdr->exidx_size;
+    p = (const unsigned char *)(hdr + 1);
+    obj->fn_index = (const unsigned *)p;
+    obj->fn_count = hdr->fn_count;
+    p += hdr->fn_count * sizeof(unsigned);
+    obj->exidx_data = p;
+    p += hdr->exidx_size;
+    if (hdr->extab_size) {
+        obj->extab_start = hdr->extab_vaddr + obj->bias;
+        obj->extab_end = obj->extab_start + hdr->extab_size;
+        obj->extab_data = p;
+    }
+    obj->cache_image = image;
+    obj->cache_size = sb.st_size;
+    return 0;
+}
+
+static int compare_mtime(const void *a, const void *b)
+{
+    const ucache_file *fa = a;
+    const ucache_file *fb = b;
+
+    if (fa->mtime < fb->mtime) return -1;
+    if (fa->mtime > fb->mtime) return 1;
+    return 0;
+}
+
+/* Remove the least recently used entries until the cache fits */
+static void trim_cache(void)
+{
+    char path[PATH_MAX];
+    ucache_file *files = NULL, *nfiles;
+    int count = 0, size = 0, i;
+    off_t total = 0;
+    struct dirent *de;
+    struct stat sb;
+    DIR *dir;
+
+    dir = opendir(cache_dir);
+    if (!dir) {
+        return;
+    }
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.' ||
+            strlen(de->d_name) >= sizeof(files->name)) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, de->d_name);
+        if (stat(path, &sb) || !S_ISREG(sb.st_mode)) {
+            continue;
+        }
+        if (count == size) {
+            nfiles = arena_realloc(files, (size ? size*2 : 32) *
+                                   sizeof(ucache_file));
+            if (!nfiles) {
+                break;
+            }
+            files = nfiles;
+            size = size ? size*2 : 32;
+        }
+        strcpy(files[count].name, de->d_name);
+        files[count].mtime = sb.st_mtime;
+        files[count].size = sb.st_size;
+        total += sb.st_size;
+        count++;
+    }
+    closedir(dir);
+
+    if (total > cache_max) {
+        qsort(files, count, sizeof(ucache_file), compare_mtime);
+        for (i = 0; i < count && total > cache_max; i++) {
+            snprintf(path, sizeof(path), "%s/%s", cache_dir, files[i].name);
+            if (unlink(path) == 0) {
+                total -= files[i].size;
+            }
+        }
+    }
+    arena_free(files);
+}
+
+void unwind_cache_store(const elfobj *obj)
+{
+    char path[PATH_MAX], tmp[PATH_MAX];
+    ucache_header hdr;
+    struct iovec iov[4];
+    ssize_t want;
+    int fd;
+
+    if (!cache_dir || !obj->cache_key[0] || !obj->fn_index ||
+        obj->cache_image) {
+        return;
+    }
+
+    hdr.magic = UCACHE_MAGIC;
+    hdr.version = UCACHE_VERSION;
+    hdr.load_vaddr = obj->base - obj->bias;
+    hdr.exidx_vaddr = obj->exidx_start - obj->bias;
+    hdr.exidx_size = obj->exidx_end - obj->exidx_start;
+    hdr.extab_vaddr = obj->extab_data ? obj->extab_start - obj->bias : 0;
+    hdr.extab_size = obj->extab_data ? obj->extab_end - obj->extab_start : 0;
+    hdr.fn_count = obj->fn_count;
+
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = (void *)obj->fn_index;
+    iov[1].iov_len = obj->fn_count * sizeof(unsigned);
+    iov[2].iov_base = (void *)obj->exidx_data;
+    iov[2].iov_len = hdr.exidx_size;
+    iov[3].iov_base = (void *)obj->extab_data;
+    iov[3].iov_len = hdr.extab_size;
+    want = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len + iov[3].iov_len;
+
+    /* write it under a temporary name, so that nobody sees half of it */
+    snprintf(tmp, sizeof(tmp), "%s/.tmp-%d", cache_dir, getpid());
+    snprintf(path, sizeof(path), "%s/%s", cache_dir, obj->cache_key);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    if (writev(fd, iov, 4) != want) {
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+    close(fd);
+    if (rename(tmp, path)) {
+        unlink(tmp);
+        return;
+    }
+
+    trim_cache();
+}
@@ -0,0 +1,45 @@
+/* unwind-cache.h - on-disk cache of unwind indexes
+**
+** Copyright 2011,2012 Sony Network Entertainment
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef __unwind_cache_h
+#define __unwind_cache_h
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include "utility.h" /* needed for elfobj */
+
+/* Use dir for the cache, keeping it under max_size bytes.  Until this is
+ * called the cache is neither read nor written.
+ */
+extern void unwind_cache_init(const char *dir, size_t max_size);
+
+/* Work out the cache key of an object: the GNU build-id if it has one,
+ * otherwise the device, inode and mtime of its mapped file in sb.  With
+ * no build-id and sb NULL the key is left empty.
+ */
+extern void unwind_cache_key(elfobj *obj, const struct stat *sb);
+
+/* Fill in the load bias and unwind tables of obj from the cache.
+ * Returns 0 on a hit.
+ */
+extern int unwind_cache_load(elfobj *obj);
+
+/* Save the unwind tables of obj, if they are in memory here */
+extern void unwind_cache_store(const elfobj *obj);
+
+#endif
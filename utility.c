@@ -16,67 +16,683 @@
 */
 
 #include <sys/ptrace.h>
-#include <assert.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 
 #include "utility.h"
+#include "arena.h"
 
-/* Get a word from pid using ptrace. The result is the return value. */
-int get_remote_word(int pid, void *src)
+#define PAGE_SIZE_4K    4096
+
+/* number of hash chains in the remote page cache */
+#define CACHE_HASH_SIZE 256
+
+/* cleared once the kernel tells us it has no process_vm_readv */
+static int have_vm_readv = 1;
+
+/*
+ * Remote page cache.  Every page of the crashing process that we look at
+ * is copied over once, in bulk, and kept until flush_remote_cache().
+ * Pages that can't be read are remembered too (with a NULL data pointer),
+ * so we don't keep asking the kernel for them.
+ */
+typedef struct cached_page {
+    struct cached_page *next;
+    unsigned long addr;
+    unsigned char *data;
+} cached_page;
+
+static cached_page *page_hash[CACHE_HASH_SIZE];
+static int cache_pid = -1;
+
+/* Single-iovec wrapper for process_vm_readv.  This goes through syscall()
+ * so that we don't depend on the C library being new enough to have it.
+ */
+static ssize_t vm_readv(int pid, void *src, void *dst, size_t size)
+{
+#ifdef __NR_process_vm_readv
+    struct iovec local, remote;
+    ssize_t count;
+
+    if (!have_vm_readv) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    local.iov_base = dst;
+    local.iov_len = size;
+    remote.iov_base = src;
+    remote.iov_len = size;
+    count = syscall(__NR_process_vm_readv, pid, &local, 1, &remote, 1, 0);
+    if (count < 0 && errno == ENOSYS) {
+        have_vm_readv = 0;
+    }
+    return count;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* Read size bytes one word at a time with PTRACE_PEEKTEXT.
+ * Returns the number of bytes copied before the first failed peek.
+ */
+static size_t peek_remote_block(int pid, void *src, void *dst, size_t size)
 {
-    return ptrace(PTRACE_PEEKTEXT, pid, src, NULL);
+    size_t i;
+    long val;
+
+    for (i = 0; i < size; i += sizeof(long)) {
+        errno = 0;
+        val = ptrace(PTRACE_PEEKTEXT, pid, src+i, NULL);
+        if (val == -1 && errno) {
+            break;
+        }
+        if (size - i < sizeof(long)) {
+            memcpy(dst+i, &val, size - i);
+            return size;
+        }
+        memcpy(dst+i, &val, sizeof(long));
+    }
+    return i;
 }
 
+/* Read a block of memory from pid, using one process_vm_readv call
+ * for as much of it as the kernel will give us.  Whatever is left
+ * over (pages the kernel refused, or a kernel without process_vm_readv)
+ * is read a page at a time, falling back to ptrace peeks for pages that
+ * still can't be read in bulk.  Returns the number of bytes copied,
+ * which is less than size if an unreadable page was hit.
+ */
+size_t get_remote_block(int pid, void *src, void *dst, size_t size)
+{
+    size_t done = 0;
+    ssize_t count;
+
+    count = vm_readv(pid, src, dst, size);
+    if (count > 0) {
+        done = count;
+    }
+
+    while (done < size) {
+        unsigned long addr = (unsigned long)src + done;
+        size_t chunk = PAGE_SIZE_4K - (addr & (PAGE_SIZE_4K-1));
+        size_t got;
+
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+
+        count = vm_readv(pid, src+done, dst+done, chunk);
+        if (count == (ssize_t)chunk) {
+            done += chunk;
+            continue;
+        }
+
+        got = peek_remote_block(pid, src+done, dst+done, chunk);
+        done += got;
+        if (got < chunk) {
+            break;
+        }
+    }
+    return done;
+}
+
+/* Find the cached copy of the page at addr, reading it in if this is the
+ * first time it has been asked for.  Returns NULL if the page is
+ * unreadable.
+ */
+static unsigned char *get_cached_page(int pid, unsigned long addr)
+{
+    static unsigned char scratch_page[PAGE_SIZE_4K];
+    cached_page **head, *cp;
+    unsigned char *data;
+
+    if (pid != cache_pid) {
+        flush_remote_cache();
+        cache_pid = pid;
+    }
+
+    head = &page_hash[(addr / PAGE_SIZE_4K) % CACHE_HASH_SIZE];
+    for (cp = *head; cp; cp = cp->next) {
+        if (cp->addr == addr) {
+            return cp->data;
+        }
+    }
+
+    cp = arena_alloc(sizeof(cached_page));
+    data = arena_alloc(PAGE_SIZE_4K);
+    if (!cp || !data) {
+        /* out of room: read the page into scratch space, uncached */
+        arena_free(data);
+        arena_free(cp);
+        if (get_remote_block(pid, (void *)addr, scratch_page,
+                             PAGE_SIZE_4K) != PAGE_SIZE_4K) {
+            return NULL;
+        }
+        return scratch_page;
+    }
+    cp->addr = addr;
+    cp->data = data;
+    if (get_remote_block(pid, (void *)addr, cp->data,
+                         PAGE_SIZE_4K) != PAGE_SIZE_4K) {
+        /* negative entry */
+        arena_free(cp->data);
+        cp->data = NULL;
+    }
+    cp->next = *head;
+    *head = cp;
+
+    return cp->data;
+}
+
+/* Copy size bytes at src in pid through the page cache.
+ * Returns the number of bytes copied before the first unreadable page.
+ */
+size_t get_remote_cached(int pid, void *src, void *dst, size_t size)
+{
+    size_t done = 0;
 
-/* Handy routine to read aggregated data from pid using ptrace. The read 
+    while (done < size) {
+        unsigned long addr = (unsigned long)src + done;
+        unsigned long offset = addr & (PAGE_SIZE_4K-1);
+        size_t chunk = PAGE_SIZE_4K - offset;
+        unsigned char *page;
+
+        page = get_cached_page(pid, addr - offset);
+        if (!page) {
+            break;
+        }
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+        memcpy(dst+done, page+offset, chunk);
+        done += chunk;
+    }
+    return done;
+}
+
+/* Drop all cached pages.  This should be called once the report for a
+ * crash is finished.
+ */
+void flush_remote_cache(void)
+{
+    cached_page *cp, *next;
+    int i;
+
+    for (i = 0; i < CACHE_HASH_SIZE; i++) {
+        for (cp = page_hash[i]; cp; cp = next) {
+            next = cp->next;
+            arena_free(cp->data);
+            arena_free(cp);
+        }
+        page_hash[i] = NULL;
+    }
+    cache_pid = -1;
+}
+
+/* Get a word from pid using the page cache. The result is the return value.
+ * As with PTRACE_PEEKTEXT, an unreadable address gives -1.
+ */
+int get_remote_word(int pid, void *src)
+{
+    int val;
+
+    if (get_remote_cached(pid, src, &val, sizeof(val)) != sizeof(val)) {
+        return -1;
+    }
+    return val;
+}
+
+/* Handy routine to read aggregated data from pid. The read 
  * values are written to the dest locations directly. 
+ * Any bytes that could not be read are set to 0xff, which is what a
+ * failed PTRACE_PEEKTEXT used to leave behind.
  */
 void get_remote_struct(int pid, void *src, void *dst, size_t size)
 {
-    unsigned int i;
+    size_t done;
 
-    for (i = 0; i+4 <= size; i+=4) {
-        *(int *)(dst+i) = ptrace(PTRACE_PEEKTEXT, pid, src+i, NULL);
+    done = get_remote_cached(pid, src, dst, size);
+    if (done < size) {
+        memset(dst+done, 0xff, size-done);
     }
+}
 
-    if (i < size) {
-        int val;
+/* Add a map to the table, growing it as needed */
+int maptable_add(maptable *mt, const mapinfo *mi)
+{
+    mapinfo *map;
 
-        assert((size - i) < 4);
-        val = ptrace(PTRACE_PEEKTEXT, pid, src+i, NULL);
-        while (i < size) {
-            ((unsigned char *)dst)[i] = val & 0xff;
-            i++;
-            val >>= 8;
+    if (mt->count == mt->size) {
+        map = arena_realloc(mt->map, (mt->size ? mt->size*2 : 64) * sizeof(*map));
+        if (!map) {
+            return -1;
         }
+        mt->map = map;
+        mt->size = mt->size ? mt->size*2 : 64;
     }
+    mt->map[mt->count++] = *mi;
+    return 0;
 }
 
-/* Map a pc address to the name of the containing ELF file */
-const char *map_to_name(mapinfo *mi, unsigned pc, const char* def)
+static int compare_mapinfo(const void *a, const void *b)
+{
+    const mapinfo *ma = a;
+    const mapinfo *mb = b;
+
+    if (ma->start < mb->start) return -1;
+    if (ma->start > mb->start) return 1;
+    return 0;
+}
+
+/* Sort the table by start address.  /proc/<pid>/maps is already in
+ * order, so this is usually just a check.
+ */
+void maptable_sort(maptable *mt)
 {
-    while(mi) {
-        if((pc >= mi->start) && (pc < mi->end)){
-            return mi->name;
+    int i;
+
+    for (i = 1; i < mt->count; i++) {
+        if (mt->map[i-1].start > mt->map[i].start) {
+            qsort(mt->map, mt->count, sizeof(*mt->map), compare_mapinfo);
+            break;
         }
-        mi = mi->next;
     }
-    return def;
+    mt->last = 0;
 }
 
-/* Find the containing map info for the pc */
-const mapinfo *pc_to_mapinfo(mapinfo *mi, unsigned pc, unsigned *rel_pc)
+/* FNV-1a, for the name and object hashes */
+static unsigned hash_string(const char *str)
 {
-    while(mi) {
-        if((pc >= mi->start) && (pc < mi->end)){
-            // Only calculate the relative offset for shared libraries
-            if (strstr(mi->name, ".so")) {
-                *rel_pc = pc - mi->start;
+    unsigned h = 2166136261u;
+
+    while (*str) {
+        h = (h ^ (unsigned char)*str++) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Map names are interned through one hash of the distinct names, and then
+ * each (name, base) pair is looked up in a second hash of the objects.
+ * Both are open-addressed, at most half full, and only live for the
+ * duration of this call.
+ */
+int maptable_link_objects(maptable *mt)
+{
+    const char **names;
+    elfobj **objs;
+    unsigned size, mask, h, nh, base;
+    mapinfo *mi;
+    elfobj *obj;
+    int i;
+
+    if (mt->count == 0) {
+        return 0;
+    }
+    for (size = 16; size < 2 * (unsigned)mt->count; size *= 2)
+        ;
+    mask = size - 1;
+
+    mt->obj = arena_calloc(mt->count, sizeof(elfobj));
+    names = arena_calloc(size, sizeof(*names));
+    objs = arena_calloc(size, sizeof(*objs));
+    if (!mt->obj || !names || !objs) {
+        arena_free(objs);
+        arena_free(names);
+        return -1;
+    }
+
+    for (i = 0; i < mt->count; i++) {
+        mi = &mt->map[i];
+
+        nh = hash_string(mi->name);
+        for (h = nh & mask; names[h]; h = (h + 1) & mask) {
+            if (strcmp(names[h], mi->name) == 0) {
+                break;
+            }
+        }
+        if (!names[h]) {
+            names[h] = mi->name;
+        }
+        mi->name = names[h];
+
+        base = mi->start - mi->offset;
+        for (h = (nh ^ (base >> 12)) & mask; objs[h]; h = (h + 1) & mask) {
+            if (objs[h]->name == mi->name && objs[h]->base == base) {
+                break;
             }
+        }
+        if (!objs[h]) {
+            obj = &mt->obj[mt->nobj++];
+            obj->name = mi->name;
+            obj->base = base;
+            obj->shared = strstr(mi->name, ".so") != NULL;
+            objs[h] = obj;
+        }
+        mi->obj = objs[h];
+    }
+
+    arena_free(objs);
+    arena_free(names);
+    return 0;
+}
+
+/* Only the chunks of the address space that have code in them get a
+ * bitmap, so the whole thing is usually a few KiB.
+ */
+int maptable_index_pages(maptable *mt)
+{
+    unsigned **pages;
+    unsigned *chunk;
+    unsigned page, last;
+    int i;
+
+    pages = arena_calloc(EXEC_CHUNKS, sizeof(*pages));
+    if (!pages) {
+        return -1;
+    }
+    mt->pages = pages;
+
+    for (i = 0; i < mt->count; i++) {
+        if (mt->map[i].end <= mt->map[i].start) {
+            continue;
+        }
+        page = mt->map[i].start >> EXEC_PAGE_SHIFT;
+        last = (mt->map[i].end - 1) >> EXEC_PAGE_SHIFT;
+        for (; page <= last; page++) {
+            chunk = pages[page >> (EXEC_CHUNK_SHIFT - EXEC_PAGE_SHIFT)];
+            if (!chunk) {
+                chunk = arena_calloc(EXEC_CHUNK_WORDS, sizeof(unsigned));
+                if (!chunk) {
+                    /* lookups fall back to the map table */
+                    mt->pages = NULL;
+                    return -1;
+                }
+                pages[page >> (EXEC_CHUNK_SHIFT - EXEC_PAGE_SHIFT)] = chunk;
+            }
+            chunk[(page >> 5) & (EXEC_CHUNK_WORDS - 1)] |= 1u << (page & 31);
+        }
+    }
+    return 0;
+}
+
+void free_maptable(maptable *mt)
+{
+    int i;
+
+    if (!mt) {
+        return;
+    }
+    if (mt->pages) {
+        for (i = 0; i < EXEC_CHUNKS; i++) {
+            arena_free(mt->pages[i]);
+        }
+        arena_free(mt->pages);
+    }
+    for (i = 0; i < mt->nobj; i++) {
+        if (mt->obj[i].image) {
+            munmap((void *)mt->obj[i].image, mt->obj[i].image_size);
+        }
+        if (mt->obj[i].cache_image) {
+            munmap(mt->obj[i].cache_image, mt->obj[i].cache_size);
+        } else {
+            arena_free((void *)mt->obj[i].fn_index);
+        }
+    }
+    arena_free(mt->obj);
+    arena_free(mt->text);
+    arena_free(mt->map);
+    arena_free(mt);
+}
+
+static unsigned hash_frame(unsigned pc, unsigned sp)
+{
+    unsigned h = pc * 2654435761u ^ sp;
+
+    return h ^ (h >> 15);
+}
+
+/*
+ * The (pc, sp) hash is open-addressed and kept at most half full, so
+ * every frame costs the same to check however deep the stack is.  It is
+ * rebuilt at twice the size whenever it fills up.
+ */
+int frametable_add(frametable *ft, unsigned pc, unsigned sp, int method)
+{
+    frameinfo *frame;
+    int *seen;
+    unsigned mask, h;
+    int i, size;
+
+    if (ft->limit && ft->count >= ft->limit) {
+        return -1;
+    }
+
+    if (2 * (ft->count + 1) > ft->seen_size) {
+        size = ft->seen_size ? ft->seen_size*2 : 128;
+        seen = arena_calloc(size, sizeof(int));
+        if (!seen) {
+            return -1;
+        }
+        mask = size - 1;
+        for (i = 0; i < ft->count; i++) {
+            frame = &ft->frame[i];
+            for (h = hash_frame(frame->pc, frame->sp) & mask; seen[h];
+                 h = (h + 1) & mask) {
+            }
+            seen[h] = i + 1;
+        }
+        arena_free(ft->seen);
+        ft->seen = seen;
+        ft->seen_size = size;
+    }
+
+    mask = ft->seen_size - 1;
+    for (h = hash_frame(pc, sp) & mask; ft->seen[h]; h = (h + 1) & mask) {
+        frame = &ft->frame[ft->seen[h] - 1];
+        if (frame->pc == pc && frame->sp == sp) {
+            return 1;
+        }
+    }
+
+    if (ft->count == ft->size) {
+        frame = arena_realloc(ft->frame, (ft->size ? ft->size*2 : 64) *
+                              sizeof(*frame));
+        if (!frame) {
+            return -1;
+        }
+        ft->frame = frame;
+        ft->size = ft->size ? ft->size*2 : 64;
+    }
+    ft->seen[h] = ft->count + 1;
+    ft->frame[ft->count].pc = pc;
+    ft->frame[ft->count].sp = sp;
+    ft->frame[ft->count].method = method;
+    ft->count++;
+    return 0;
+}
+
+void frametable_clear(frametable *ft)
+{
+    arena_free(ft->seen);
+    arena_free(ft->frame);
+    ft->frame = NULL;
+    ft->count = 0;
+    ft->size = 0;
+    ft->seen = NULL;
+    ft->seen_size = 0;
+    ft->stop = FRAMES_END;
+}
+
+/* Find the map containing addr.  Consecutive lookups tend to land in the
+ * same library, so the last hit is checked before the binary search.
+ */
+mapinfo *find_mapinfo(maptable *mt, unsigned addr)
+{
+    mapinfo *mi;
+    int left, right, n;
+
+    if (!mt || mt->count == 0) {
+        return NULL;
+    }
+
+    mi = &mt->map[mt->last];
+    if (addr >= mi->start && addr < mi->end) {
+        return mi;
+    }
+
+    left = 0;
+    right = mt->count - 1;
+    while (left <= right) {
+        n = (left + right) / 2;
+        mi = &mt->map[n];
+        if (addr < mi->start) {
+            right = n - 1;
+        } else if (addr >= mi->end) {
+            left = n + 1;
+        } else {
+            mt->last = n;
             return mi;
         }
-        mi = mi->next;
     }
     return NULL;
 }
+
+/* Map a pc address to the name of the containing ELF file */
+const char *map_to_name(maptable *mt, unsigned pc, const char* def)
+{
+    mapinfo *mi;
+
+    /* most words that get here are data, not code addresses */
+    if (!addr_in_code(mt, pc)) {
+        return def;
+    }
+    mi = find_mapinfo(mt, pc);
+
+    return mi ? mi->name : def;
+}
+
+/* Find the containing map info for the pc */
+const mapinfo *pc_to_mapinfo(maptable *mt, unsigned pc, unsigned *rel_pc)
+{
+    mapinfo *mi = find_mapinfo(mt, pc);
+
+    // Only calculate the relative offset for shared libraries
+    if (mi && (mi->obj ? mi->obj->shared : strstr(mi->name, ".so") != NULL)) {
+        *rel_pc = pc - mi->start;
+    }
+    return mi;
+}
+
+char *next_maps_field(char *p)
+{
+    while (*p && *p != ' ') p++;
+    while (*p == ' ') p++;
+    return p;
+}
+
+/*
+ * parse a memory map line, in place.  A line looks like:
+ *   6f000000-6f01e000 r-xp 00000000 b3:01 1638       /system/lib/libfoo.so
+ * but the addresses, device and inode vary in width, and the name may be
+ * missing or contain spaces, so fields are found by scanning rather than
+ * by column.  The name is left pointing into line.
+ * Note: only executable maps are returned (as 1).  Other maps (data,
+ * stack, etc.) are ignored, apart from noting where the stack is, in
+ * stack if that is set.
+ */
+static int parse_maps_line(char *line, mapinfo *mi, mapinfo *stack)
+{
+    char *p, *perms;
+
+    while (*line == ' ') line++;
+
+    mi->start = strtoul(line, &p, 16);
+    if (*p != '-') return 0;
+    mi->end = strtoul(p + 1, &p, 16);
+    if (*p != ' ') return 0;
+
+    perms = next_maps_field(p);
+    p = next_maps_field(perms);
+    mi->offset = strtoul(p, 0, 16);
+    p = next_maps_field(p);         /* device */
+    p = next_maps_field(p);         /* inode */
+    mi->name = next_maps_field(p);
+
+    /* capture size of stack */
+    if (strcmp(mi->name, "[stack]") == 0) {
+        if (stack) {
+            stack->start = mi->start;
+            stack->end = mi->end;
+            stack->name = "[stack]";
+        }
+        return 0;
+    }
+
+    /* ignore non-executable segments */
+    if (strnlen(perms, 4) < 4 || perms[2] != 'x') return 0;
+
+    mi->obj = NULL;
+    return 1;
+}
+
+/*
+ * The text is kept by the table, for write_memory_maps(), and the map
+ * names point into it, so nothing is allocated per line.
+ */
+void parse_maps_text(maptable *milist, char *text, int size, mapinfo *stack)
+{
+    char *line, *eol;
+    mapinfo mi;
+
+    text[size] = 0;
+
+    /* each line is cut at its newline, so the name at the end of it is
+     * terminated where it is
+     */
+    for (line = text; line < text + size; line = eol + 1) {
+        eol = strchr(line, '\n');
+        if (!eol) {
+            eol = text + size;
+        }
+        *eol = 0;
+        if (parse_maps_line(line, &mi, stack)) {
+            maptable_add(milist, &mi);
+        }
+    }
+    milist->text = text;
+    milist->text_size = size;
+    maptable_sort(milist);
+    maptable_link_objects(milist);
+    maptable_index_pages(milist);
+}
+
+int find_maps_region(const maptable *mt, unsigned addr, unsigned *start,
+                     unsigned *end)
+{
+    const char *line, *text_end;
+    char *p;
+
+    if (!mt || !mt->text) {
+        return 0;
+    }
+    text_end = mt->text + mt->text_size;
+    for (line = mt->text; line < text_end; line += strlen(line) + 1) {
+        *start = strtoul(line, &p, 16);
+        if (*p != '-') {
+            continue;
+        }
+        *end = strtoul(p + 1, 0, 16);
+        if (addr >= *start && addr < *end) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -27,28 +27,212 @@
 
 #define STACK_CONTENT_DEPTH 32
 
-typedef struct mapinfo {
-    struct mapinfo *next;
+/* longest GNU build-id kept; the usual SHA-1 one is 20 bytes */
+#define MAX_BUILD_ID 32
+
+/* bounds of the stack copied out of the crashing thread */
+typedef struct stack_snapshot {
     unsigned start;
     unsigned end;
+} stack_snapshot;
+
+/* One loaded ELF file.  Every map of the file that comes from the same
+ * load shares one of these, so its headers are only read once.
+ */
+typedef struct elfobj {
+    const char *name;       /* interned, so names can be compared by pointer */
+    unsigned base;          /* address where file offset 0 is mapped */
+    int parsed;             /* headers have been looked at */
+    int shared;             /* a shared library, with a ".so" name */
+    unsigned bias;          /* load bias: run-time minus link-time address */
     unsigned exidx_start;
     unsigned exidx_end;
-    char name[];
+    unsigned exidx_offset;  /* file offset of the EXIDX table */
+    unsigned extab_start;   /* .ARM.extab, if the file has section headers */
+    unsigned extab_end;
+    unsigned build_id_len;  /* 0 if there is no NT_GNU_BUILD_ID note */
+    unsigned char build_id[MAX_BUILD_ID];
+
+    /* the backing file, mapped read-only */
+    int tables_tried;       /* file and unwind cache have been looked for */
+    const unsigned char *image;
+    size_t image_size;
+    int image_trusted;      /* known to be the file that is mapped */
+    char cache_key[64];     /* name of its entry in the unwind cache */
+
+    /* local copies of the unwind tables, in the file or the unwind cache,
+     * and the start (link-time) of the function of each EXIDX entry
+     */
+    const unsigned char *exidx_data;
+    const unsigned char *extab_data;
+    const unsigned *fn_index;
+    unsigned fn_count;
+    void *cache_image;
+    size_t cache_size;
+} elfobj;
+
+typedef struct mapinfo {
+    unsigned start;
+    unsigned end;
+    unsigned offset;        /* file offset of start */
+    const char *name;       /* points into the maps text (or core note) */
+    elfobj *obj;            /* set by maptable_link_objects */
 } mapinfo;
 
-/* Get a word from pid using ptrace. The result is the return value. */
+/* The executable maps of a process, sorted by start address */
+typedef struct maptable {
+    mapinfo *map;
+    int count;
+    int size;
+    int last;       /* index of the last lookup hit */
+    char *text;     /* the maps file the names point into, if any */
+    int text_size;
+    elfobj *obj;    /* the distinct objects behind the maps */
+    int nobj;
+    int pid;        /* process the maps belong to, or 0 for a core file */
+    unsigned **pages;   /* executable pages, see maptable_index_pages */
+} maptable;
+
+/* The executable page bitmap has one pointer per 4 MiB of address space,
+ * to a bitmap of its 4 KiB pages, or NULL if none of them are executable.
+ */
+#define EXEC_PAGE_SHIFT     12
+#define EXEC_CHUNK_SHIFT    22
+#define EXEC_CHUNKS         (1 << (32 - EXEC_CHUNK_SHIFT))
+#define EXEC_CHUNK_WORDS    (1 << (EXEC_CHUNK_SHIFT - EXEC_PAGE_SHIFT - 5))
+
+/* How a frame was found */
+#define FRAME_TABLE     0   /* unwind tables */
+#define FRAME_GUESS     1   /* return address found by scanning the stack */
+#define FRAME_FP        2   /* frame pointer chain */
+#define FRAME_EMULATED  3   /* found by interpreting the code */
+
+/* One frame of a backtrace */
+typedef struct frameinfo {
+    unsigned pc;    /* the call site, or where it crashed for frame 0 */
+    unsigned sp;
+    int method;     /* FRAME_* */
+} frameinfo;
+
+/* Why an unwinder stopped */
+#define FRAMES_END      0   /* reached the outermost frame */
+#define FRAMES_NO_TABLE 1   /* no unwind information for stop_pc */
+#define FRAMES_LOOP     2   /* a frame came round again */
+#define FRAMES_LIMIT    3   /* out of room, or hit the frame budget */
+#define FRAMES_BAD_LINK 4   /* the frame pointer chain went somewhere odd */
+
+/* The frames an unwinder has found, innermost first */
+typedef struct frametable {
+    frameinfo *frame;
+    int count;
+    int size;
+    int limit;      /* most frames to take, or 0 for no limit */
+    int *seen;      /* hash of (pc, sp) to frame index + 1 */
+    int seen_size;
+    int stop;       /* FRAMES_*, with where it happened */
+    unsigned stop_pc;
+    unsigned stop_sp;
+} frametable;
+
+
+/* Read a block of memory from pid, in bulk with process_vm_readv where
+ * possible and with ptrace peeks where not.  Returns the number of bytes
+ * read before the first unreadable page.
+ */
+extern size_t get_remote_block(int pid, void *src, void *dst, size_t size);
+
+/* Read a block of memory from pid through the remote page cache.
+ * Returns the number of bytes read before the first unreadable page.
+ */
+extern size_t get_remote_cached(int pid, void *src, void *dst, size_t size);
+
+/* Get a word from pid, through the remote page cache. The result is the
+ * return value, or -1 if the address can't be read.
+ */
 extern int get_remote_word(int pid, void *src);
 
-/* Handy routine to read aggregated data from pid using ptrace. The read 
- * values are written to the dest locations directly. 
+/* Handy routine to read aggregated data from pid, through the remote page
+ * cache. The read values are written to the dest locations directly. 
  */
 extern void get_remote_struct(int pid, void *src, void *dst, size_t size);
 
+/* Throw away everything in the remote page cache */
+extern void flush_remote_cache(void);
+
+/* Add a copy of mi to the table.  The name is not copied, so it must
+ * live as long as the table does.  Returns 0 on success.
+ */
+extern int maptable_add(maptable *mt, const mapinfo *mi);
+
+/* Sort the table by start address, after all maps have been added */
+extern void maptable_sort(maptable *mt);
+
+/* Intern the map names and group the maps into objects, keyed by name
+ * and load base.  Call this once, after maptable_sort().
+ */
+extern int maptable_link_objects(maptable *mt);
+
+/* Build the executable page bitmap of the table, after
+ * maptable_sort().  Returns 0 on success.
+ */
+extern int maptable_index_pages(maptable *mt);
+
+/* Free the table, its maps and its text */
+extern void free_maptable(maptable *mt);
+
+/* Add a frame to the table.  Returns 0 on success, 1 if the same (pc, sp)
+ * is already in the table (so the unwinder is going round in circles), or
+ * -1 if the table is full.
+ */
+extern int frametable_add(frametable *ft, unsigned pc, unsigned sp,
+                          int method);
+
+/* Empty the table and free what it holds, but not the table itself */
+extern void frametable_clear(frametable *ft);
+
+/* Find the map containing addr, or NULL */
+extern mapinfo *find_mapinfo(maptable *mt, unsigned addr);
+
 /* Find the containing map for the pc */
-const mapinfo *pc_to_mapinfo (mapinfo *mi, unsigned pc, unsigned *rel_pc);
+const mapinfo *pc_to_mapinfo (maptable *mt, unsigned pc, unsigned *rel_pc);
+
+/* Does addr lie in one of the executable maps?  With the page bitmap
+ * built this is a couple of loads, so it can be asked of every word of
+ * the stack.
+ */
+static inline int addr_in_code(maptable *mt, unsigned addr)
+{
+    const unsigned *chunk;
+    unsigned page;
+
+    if (!mt || !mt->pages) {
+        return find_mapinfo(mt, addr) != NULL;
+    }
+    chunk = mt->pages[addr >> EXEC_CHUNK_SHIFT];
+    page = (addr >> EXEC_PAGE_SHIFT) & ((1 << (EXEC_CHUNK_SHIFT -
+                                               EXEC_PAGE_SHIFT)) - 1);
+    return chunk && (chunk[page >> 5] >> (page & 31)) & 1;
+}
+
+/* skip to the next space-separated field of a maps line */
+extern char *next_maps_field(char *p);
+
+/* Fill mt from maps text (of size bytes, with room for a terminator
+ * after it), as /proc/<pid>/maps has it.  Where the stack is goes in
+ * stack, if that is set.
+ */
+extern void parse_maps_text(maptable *mt, char *text, int size,
+                            mapinfo *stack);
+
+/* Find the map of any kind (not just the executable ones in the table)
+ * that contains addr, from the maps text kept by parse_maps_text().
+ * Returns 1 if there is one.
+ */
+extern int find_maps_region(const maptable *mt, unsigned addr,
+                            unsigned *start, unsigned *end);
 
 /* Map a pc address to the name of the containing ELF file */
-const char *map_to_name(mapinfo *mi, unsigned pc, const char* def);
+const char *map_to_name(maptable *mt, unsigned pc, const char* def);
 
 /* Log information onto the tombstone */
 extern void _LOG(int tfd, bool in_tombstone_only, const char *fmt, ...);